@@ -12,6 +12,7 @@ func main() {
 	convert := flag.Bool("convert", false, "convert request")
 	stem := flag.Bool("stem", false, "whether to stem reply or not")
 	urls := flag.Bool("urls", false, "whether to return array of all urls found in request [a href, img src]")
+	use_msgpack := flag.Bool("msgpack", false, "use msgpack instead of JSON for requests and replies")
 	addr := flag.String("warp", "", "warp server address")
 	text := flag.String("text", "", "message to process, format: prefix:string")
 
@@ -37,6 +38,7 @@ func main() {
 	if err != nil {
 		log.Fatalf("Could not create new warp engine: %v", err)
 	}
+	w.UseMsgpack(*use_msgpack)
 
 	r := warp.CreateRequest()
 	r.Insert(tt[0], tt[1])
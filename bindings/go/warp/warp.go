@@ -4,17 +4,21 @@ import (
 	"bytes"
 	"encoding/json"
 	"fmt"
+	"github.com/vmihailenco/msgpack"
 	"io/ioutil"
 	"math/rand"
 	"net/http"
 	"strconv"
 )
 
+const MsgpackContentType = "application/msgpack"
+
 type Engine struct {
 	convert_url	string
 	tokenize_url	string
 	tr		*http.Transport
 	client		*http.Client
+	use_msgpack	bool
 }
 
 func NewEngine(addr string) (*Engine, error) {
@@ -32,29 +36,51 @@ func NewEngine(addr string) (*Engine, error) {
 	return w, nil
 }
 
+// UseMsgpack switches requests and replies from JSON to msgpack, schema is the same
+func (w *Engine) UseMsgpack(enable bool) {
+	w.use_msgpack = enable
+}
+
+func (w *Engine) marshal(v interface{}) ([]byte, error) {
+	if w.use_msgpack {
+		return msgpack.Marshal(v)
+	}
+	return json.Marshal(v)
+}
+
+func (w *Engine) unmarshal(data []byte, v interface{}) error {
+	if w.use_msgpack {
+		return msgpack.Unmarshal(data, v)
+	}
+	return json.Unmarshal(data, v)
+}
 
 type Token struct {
-	Word		string		`json:"word"`
-	Stem		string		`json:"stem"`
-	Language	string		`json:"language"`
-	Positions	[]int64		`json:"positions"`
+	Word		string		`json:"word" msgpack:"word"`
+	Stem		string		`json:"stem" msgpack:"stem"`
+	Language	string		`json:"language" msgpack:"language"`
+	Positions	[]int64		`json:"positions" msgpack:"positions"`
 }
 
 type Tokenized struct {
-	Urls		[]string	`json:"urls"`
-	Tokens		[]Token		`json:"tokens"`
+	Urls		[]string	`json:"urls" msgpack:"urls"`
+	Language	string		`json:"language" msgpack:"language"`
+	Tokens		[]Token		`json:"tokens" msgpack:"tokens"`
 }
 
 type Converted struct {
-	Urls		[]string	`json:"urls"`
-	Text		string		`json:"text"`
-	Stem		string		`json:"stem"`
+	Urls		[]string	`json:"urls" msgpack:"urls"`
+	Language	string		`json:"language" msgpack:"language"`
+	Text		string		`json:"text" msgpack:"text"`
+	Stem		string		`json:"stem" msgpack:"stem"`
 }
 
 type Request struct {
-	Query		map[string]string	`json:"request"`
-	WantStem	bool			`json:"-"`
-	WantUrls	bool			`json:"-"`
+	Query		map[string]string	`json:"request" msgpack:"request"`
+	WantStem	bool			`json:"-" msgpack:"-"`
+	WantUrls	bool			`json:"-" msgpack:"-"`
+	// Fold folds ё into е and punctuation into separators
+	Fold		bool			`json:"-" msgpack:"-"`
 }
 
 type TokenizedResult struct {
@@ -69,6 +95,7 @@ func CreateRequest() *Request {
 		Query: make(map[string]string),
 		WantStem: false,
 		WantUrls: false,
+		Fold: false,
 	}
 }
 
@@ -77,7 +104,7 @@ func (r Request) Insert(key, value string) {
 }
 
 func (w *Engine) send_request(url string, lr *Request) ([]byte, error) {
-	lr_packed, err := json.Marshal(lr)
+	lr_packed, err := w.marshal(lr)
 	if err != nil {
 		return nil, fmt.Errorf("cound not marshal lexical request: %+v, error: %v", lr, err)
 	}
@@ -89,6 +116,10 @@ func (w *Engine) send_request(url string, lr *Request) ([]byte, error) {
 	}
 	xreq := strconv.Itoa(rand.Int())
 	http_request.Header.Set("X-Request", xreq)
+	if w.use_msgpack {
+		http_request.Header.Set("Content-Type", MsgpackContentType)
+		http_request.Header.Set("Accept", MsgpackContentType)
+	}
 
 	q := http_request.URL.Query()
 	if lr.WantStem {
@@ -97,6 +128,9 @@ func (w *Engine) send_request(url string, lr *Request) ([]byte, error) {
 	if lr.WantUrls {
 		q.Set("urls", "true")
 	}
+	if lr.Fold {
+		q.Set("fold", "true")
+	}
 	http_request.URL.RawQuery = q.Encode()
 
 	resp, err := w.client.Do(http_request)
@@ -124,7 +158,7 @@ func (w *Engine) Convert(lr *Request) (*ConvertedResult, error) {
 	}
 
 	var res ConvertedResult
-	err = json.Unmarshal(body, &res.Result)
+	err = w.unmarshal(body, &res.Result)
 	if err != nil {
 		return nil, fmt.Errorf("could not unpack warp response: '%s', error: %v", string(body), err)
 	}
@@ -139,7 +173,7 @@ func (w *Engine) Tokenize(lr *Request) (*TokenizedResult, error) {
 	}
 
 	var res TokenizedResult
-	err = json.Unmarshal(body, &res.Result)
+	err = w.unmarshal(body, &res.Result)
 	if err != nil {
 		return nil, fmt.Errorf("could not unpack warp response: '%s', error: %v", string(body), err)
 	}
@@ -0,0 +1,69 @@
+package warp
+
+import (
+	"bytes"
+	"github.com/vmihailenco/msgpack"
+	"io/ioutil"
+	"net/http"
+	"net/http/httptest"
+	"strings"
+	"testing"
+)
+
+// Strings longer than 31 bytes are packed as str8, server has to read them as strings too
+func TestMsgpackLongMember(t *testing.T) {
+	text := strings.Repeat("x", 40)
+
+	srv := httptest.NewServer(http.HandlerFunc(func(rw http.ResponseWriter, req *http.Request) {
+		if req.Header.Get("Content-Type") != MsgpackContentType {
+			t.Errorf("content type: %s", req.Header.Get("Content-Type"))
+		}
+
+		body, err := ioutil.ReadAll(req.Body)
+		if err != nil {
+			t.Fatalf("could not read request body: %v", err)
+		}
+
+		str8 := append([]byte{0xd9, byte(len(text))}, text...)
+		if !bytes.Contains(body, str8) {
+			t.Errorf("request member is not packed as str8: %x", body)
+		}
+
+		var r Request
+		if err := msgpack.Unmarshal(body, &r); err != nil {
+			t.Fatalf("could not unpack request: %v", err)
+		}
+
+		reply, err := msgpack.Marshal(map[string]Converted{
+			"text": Converted{
+				Language: "en",
+				Text:     r.Query["text"],
+			},
+		})
+		if err != nil {
+			t.Fatalf("could not pack reply: %v", err)
+		}
+
+		rw.Header().Set("Content-Type", MsgpackContentType)
+		rw.Write(reply)
+	}))
+	defer srv.Close()
+
+	w, err := NewEngine(strings.TrimPrefix(srv.URL, "http://"))
+	if err != nil {
+		t.Fatalf("could not create engine: %v", err)
+	}
+	w.UseMsgpack(true)
+
+	req := CreateRequest()
+	req.Insert("text", text)
+
+	res, err := w.Convert(req)
+	if err != nil {
+		t.Fatalf("convert failed: %v", err)
+	}
+
+	if res.Result["text"].Text != text {
+		t.Errorf("round trip mismatch: '%s', must be '%s'", res.Result["text"].Text, text)
+	}
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "warp/utf8.hpp"
+
 #include <map>
 #include <string>
 #include <unordered_map>
@@ -13,7 +15,7 @@ static const std::string drop_characters = "`~1234567890-=!@#$%^&*()_+[]\\{}|';\
 class alphabet {
 public:
 	alphabet(const std::string &a) {
-		ribosome::lstring lw = ribosome::lconvert::from_utf8(a);
+		ribosome::lstring lw = warp::utf8::to_lstring(a);
 		for (auto ch: lw) {
 			m_alphabet[ch] = 1;
 		}
@@ -43,7 +45,7 @@ public:
 		m_alphabets.emplace(std::pair<std::string, alphabet>(lang, alphabet(a)));
 	}
 
-	bool ok(const std::string &lang, const ribosome::lstring &lw) {
+	bool ok(const std::string &lang, const ribosome::lstring &lw) const {
 		auto it = m_alphabets.find(lang);
 		if (it == m_alphabets.end())
 			return true;
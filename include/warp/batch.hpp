@@ -0,0 +1,128 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_BATCH_HPP
+#define __WARP_BATCH_HPP
+
+#include "warp/fuzzy.hpp"
+#include "warp/json.hpp"
+
+#include <ribosome/error.hpp>
+
+#include <string.h>
+
+#include <vector>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Batch request {"documents": [{"text": "...", "operations": ["tokenize", "convert", "error_check"],
+ * "stem": bool, "urls": bool, "fold": bool, "level": int, "max_num": int}, ...]}.
+ * Document without operations is tokenized. Texts reference parsed body and are valid while this object is alive.
+ */
+class batch_request {
+public:
+	enum {
+		op_tokenize =		1<<0,
+		op_convert =		1<<1,
+		op_error_check =	1<<2,
+	};
+
+	struct document {
+		const char	*text;
+		size_t		size;
+		int		operations;
+		bool		want_stemming;
+		bool		want_urls;
+		bool		fold;
+		int		level;
+		int		max_num;
+	};
+
+	ribosome::error_info parse(const char *data, size_t size) {
+		m_documents.clear();
+
+		rapidjson::Document &doc = m_json.parse(data, size);
+		if (doc.HasParseError()) {
+			return ribosome::create_error(-EINVAL, "document parsing error: %s, offset: %ld",
+					doc.GetParseError(), (long)doc.GetErrorOffset());
+		}
+
+		if (!doc.IsObject() || !doc.HasMember("documents") || !doc["documents"].IsArray()) {
+			return ribosome::create_error(-ENOENT, "'documents' must be array");
+		}
+
+		const auto &docs = doc["documents"];
+		for (auto it = docs.Begin(), end = docs.End(); it != end; ++it) {
+			if (!it->IsObject() || !it->HasMember("text") || !(*it)["text"].IsString()) {
+				return ribosome::create_error(-EINVAL, "document %ld: 'text' must be string",
+						(long)m_documents.size());
+			}
+
+			document d;
+			d.text = (*it)["text"].GetString();
+			d.size = (*it)["text"].GetStringLength();
+			d.want_stemming = warp::get_bool(*it, "stem", false);
+			d.want_urls = warp::get_bool(*it, "urls", false);
+			d.fold = warp::get_bool(*it, "fold", false);
+			d.level = warp::get_int64(*it, "level", warp::check_control::level_3);
+			d.max_num = warp::get_int64(*it, "max_num", 3);
+			d.operations = 0;
+
+			if (it->HasMember("operations")) {
+				const auto &ops = (*it)["operations"];
+				if (!ops.IsArray()) {
+					return ribosome::create_error(-EINVAL, "document %ld: 'operations' must be array",
+							(long)m_documents.size());
+				}
+
+				for (auto op = ops.Begin(), op_end = ops.End(); op != op_end; ++op) {
+					const char *name = op->IsString() ? op->GetString() : "";
+
+					if (!strcmp(name, "tokenize")) {
+						d.operations |= op_tokenize;
+					} else if (!strcmp(name, "convert")) {
+						d.operations |= op_convert;
+					} else if (!strcmp(name, "error_check")) {
+						d.operations |= op_error_check;
+					} else {
+						return ribosome::create_error(-EINVAL, "document %ld: unknown operation '%s'",
+								(long)m_documents.size(), name);
+					}
+				}
+			}
+
+			if (!d.operations)
+				d.operations = op_tokenize;
+
+			m_documents.push_back(d);
+		}
+
+		return ribosome::error_info();
+	}
+
+	const std::vector<document> &documents() const {
+		return m_documents;
+	}
+
+private:
+	insitu_document m_json;
+	std::vector<document> m_documents;
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_BATCH_HPP */
@@ -0,0 +1,363 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_COMPLETION_HPP
+#define __WARP_COMPLETION_HPP
+
+#include <ribosome/error.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace ioremap { namespace warp { namespace completion {
+
+/*
+ * Prefix completion index is a byte-wise trie over UTF-8 word forms, every trie node
+ * stores up to top-k most frequent words of its subtree, so completion is a walk down
+ * the trie followed by reading precomputed list.
+ *
+ * File layout is flat and is used through mmap() as is:
+ *    header
+ *    node[num_nodes]		- nodes in post-order, root is the last one
+ *    edge[num_edges]		- children of every node are contiguous and sorted by byte
+ *    uint32_t top[num_top]	- word indexes, list of every node is sorted by frequency
+ *    word[num_words]
+ *    char strings[strings_size]
+ */
+struct header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	top_k;
+	uint64_t	num_nodes;
+	uint64_t	num_edges;
+	uint64_t	num_top;
+	uint64_t	num_words;
+	uint64_t	strings_size;
+};
+
+struct node {
+	uint32_t	first_edge;
+	uint32_t	num_edges;
+	uint32_t	first_top;
+	uint32_t	num_top;
+};
+
+struct edge {
+	uint32_t	node;
+	uint8_t		byte;
+	uint8_t		reserved[3];
+};
+
+struct word {
+	uint64_t	offset;
+	uint32_t	size;
+	int32_t		freq;
+};
+
+static const char index_magic[8] = "warpcmp";
+static const uint32_t index_version = 1;
+
+struct result {
+	const char	*word;
+	size_t		size;
+	int		freq;
+};
+
+class builder {
+public:
+	builder(size_t top_k) : m_top_k(top_k) {}
+
+	void add(const std::string &word, int freq) {
+		if (word.size())
+			m_words.emplace_back(word, freq);
+	}
+
+	// Builds the trie and writes it into temporary file which is renamed to @path
+	ribosome::error_info write(const std::string &path) {
+		std::sort(m_words.begin(), m_words.end());
+
+		std::vector<word> words;
+		std::string strings;
+		for (const auto &p: m_words) {
+			if (words.size() && strings.compare(words.back().offset, words.back().size, p.first) == 0) {
+				words.back().freq += p.second;
+				continue;
+			}
+
+			word w;
+			w.offset = strings.size();
+			w.size = p.first.size();
+			w.freq = p.second;
+			words.push_back(w);
+
+			strings.append(p.first);
+		}
+
+		m_nodes.clear();
+		m_edges.clear();
+		m_top.clear();
+
+		// nodes on the path of the last inserted word, level 0 is root
+		std::vector<open_node> stack(1);
+		const char *prev = NULL;
+		size_t prev_size = 0;
+
+		for (size_t idx = 0; idx < words.size(); ++idx) {
+			const char *w = strings.data() + words[idx].offset;
+			size_t size = words[idx].size;
+
+			size_t common = 0;
+			while (common < prev_size && common < size && prev[common] == w[common])
+				++common;
+
+			close(stack, words, common);
+
+			for (size_t i = common; i < size; ++i) {
+				stack.emplace_back();
+				stack.back().byte = w[i];
+			}
+
+			add_top(stack.back().top, std::vector<uint32_t>({(uint32_t)idx}), words);
+
+			prev = w;
+			prev_size = size;
+		}
+
+		close(stack, words, 0);
+		finalize(stack.front());
+
+		header h;
+		memset(&h, 0, sizeof(header));
+		memcpy(h.magic, index_magic, sizeof(h.magic));
+		h.version = index_version;
+		h.top_k = m_top_k;
+		h.num_nodes = m_nodes.size();
+		h.num_edges = m_edges.size();
+		h.num_top = m_top.size();
+		h.num_words = words.size();
+		h.strings_size = strings.size();
+
+		std::string tmp_path = path + ".tmp";
+		std::ofstream out(tmp_path.c_str(), std::ios::trunc | std::ios::binary);
+		out.write((const char *)&h, sizeof(header));
+		out.write((const char *)m_nodes.data(), m_nodes.size() * sizeof(node));
+		out.write((const char *)m_edges.data(), m_edges.size() * sizeof(edge));
+		out.write((const char *)m_top.data(), m_top.size() * sizeof(uint32_t));
+		out.write((const char *)words.data(), words.size() * sizeof(word));
+		out.write(strings.data(), strings.size());
+		out.close();
+
+		if (!out.good()) {
+			return ribosome::create_error(-EIO, "could not write completion index into %s", tmp_path.c_str());
+		}
+
+		if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+			return ribosome::create_error(-errno, "could not rename completion index %s -> %s: %s",
+					tmp_path.c_str(), path.c_str(), strerror(errno));
+		}
+
+		return ribosome::error_info();
+	}
+
+private:
+	struct open_node {
+		uint8_t byte = 0;
+		std::vector<edge> children;
+		std::vector<uint32_t> top;
+	};
+
+	size_t m_top_k;
+	std::vector<std::pair<std::string, int>> m_words;
+
+	std::vector<node> m_nodes;
+	std::vector<edge> m_edges;
+	std::vector<uint32_t> m_top;
+
+	void add_top(std::vector<uint32_t> &top, const std::vector<uint32_t> &add, const std::vector<word> &words) {
+		top.insert(top.end(), add.begin(), add.end());
+		std::sort(top.begin(), top.end(), [&] (uint32_t a, uint32_t b) {
+					if (words[a].freq != words[b].freq)
+						return words[a].freq > words[b].freq;
+					return a < b;
+				});
+
+		if (top.size() > m_top_k)
+			top.resize(m_top_k);
+	}
+
+	uint32_t finalize(const open_node &n) {
+		node out;
+		out.first_edge = m_edges.size();
+		out.num_edges = n.children.size();
+		out.first_top = m_top.size();
+		out.num_top = n.top.size();
+
+		m_edges.insert(m_edges.end(), n.children.begin(), n.children.end());
+		m_top.insert(m_top.end(), n.top.begin(), n.top.end());
+
+		m_nodes.push_back(out);
+		return m_nodes.size() - 1;
+	}
+
+	// subtrees deeper than @depth are complete, write them and link to their parents
+	void close(std::vector<open_node> &stack, const std::vector<word> &words, size_t depth) {
+		while (stack.size() > depth + 1) {
+			open_node &n = stack.back();
+			open_node &parent = stack[stack.size() - 2];
+
+			edge e;
+			memset(&e, 0, sizeof(edge));
+			e.node = finalize(n);
+			e.byte = n.byte;
+			parent.children.push_back(e);
+
+			add_top(parent.top, n.top, words);
+
+			stack.pop_back();
+		}
+	}
+};
+
+class index {
+public:
+	index() {}
+	index(const index &) = delete;
+	index &operator=(const index &) = delete;
+
+	~index() {
+		if (m_data) {
+			munmap(m_data, m_size);
+		}
+	}
+
+	ribosome::error_info open(const std::string &path) {
+		int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			return ribosome::create_error(-errno, "could not open completion index %s: %s",
+					path.c_str(), strerror(errno));
+		}
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			int err = -errno;
+			::close(fd);
+			return ribosome::create_error(err, "could not stat completion index %s: %s",
+					path.c_str(), strerror(-err));
+		}
+
+		if ((size_t)st.st_size < sizeof(header)) {
+			::close(fd);
+			return ribosome::create_error(-EINVAL, "completion index %s is too small: %ld bytes",
+					path.c_str(), (long)st.st_size);
+		}
+
+		void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED) {
+			return ribosome::create_error(-errno, "could not mmap completion index %s: %s",
+					path.c_str(), strerror(errno));
+		}
+
+		m_data = data;
+		m_size = st.st_size;
+
+		const char *ptr = (const char *)m_data;
+		m_header = (const header *)ptr;
+		if (memcmp(m_header->magic, index_magic, sizeof(index_magic)) || m_header->version != index_version) {
+			return ribosome::create_error(-EINVAL, "%s is not completion index or has unsupported version", path.c_str());
+		}
+
+		size_t expected = sizeof(header) +
+			m_header->num_nodes * sizeof(node) +
+			m_header->num_edges * sizeof(edge) +
+			m_header->num_top * sizeof(uint32_t) +
+			m_header->num_words * sizeof(word) +
+			m_header->strings_size;
+		if (expected != m_size || m_header->num_nodes == 0) {
+			return ribosome::create_error(-EINVAL, "completion index %s is corrupted: size: %zd, expected: %zd",
+					path.c_str(), m_size, expected);
+		}
+
+		ptr += sizeof(header);
+		m_nodes = (const node *)ptr;
+		ptr += m_header->num_nodes * sizeof(node);
+		m_edges = (const edge *)ptr;
+		ptr += m_header->num_edges * sizeof(edge);
+		m_top = (const uint32_t *)ptr;
+		ptr += m_header->num_top * sizeof(uint32_t);
+		m_words = (const word *)ptr;
+		ptr += m_header->num_words * sizeof(word);
+		m_strings = ptr;
+
+		return ribosome::error_info();
+	}
+
+	// Appends up to @max_num most frequent words starting with @prefix to @ret,
+	// returned word pointers are valid while index is alive
+	void complete(const char *prefix, size_t size, size_t max_num, std::vector<result> *ret) const {
+		if (!m_data)
+			return;
+
+		const node *n = &m_nodes[m_header->num_nodes - 1];
+		for (size_t i = 0; i < size; ++i) {
+			const edge *begin = m_edges + n->first_edge;
+			const edge *end = begin + n->num_edges;
+			uint8_t byte = prefix[i];
+
+			const edge *e = std::lower_bound(begin, end, byte, [] (const edge &e, uint8_t b) {
+						return e.byte < b;
+					});
+			if (e == end || e->byte != byte)
+				return;
+
+			n = &m_nodes[e->node];
+		}
+
+		for (size_t i = 0; i < n->num_top && i < max_num; ++i) {
+			const word &w = m_words[m_top[n->first_top + i]];
+
+			result res;
+			res.word = m_strings + w.offset;
+			res.size = w.size;
+			res.freq = w.freq;
+			ret->push_back(res);
+		}
+	}
+
+private:
+	void *m_data = NULL;
+	size_t m_size = 0;
+
+	const header *m_header = NULL;
+	const node *m_nodes = NULL;
+	const edge *m_edges = NULL;
+	const uint32_t *m_top = NULL;
+	const word *m_words = NULL;
+	const char *m_strings = NULL;
+};
+
+}}} // namespace ioremap::warp::completion
+
+#endif /* __WARP_COMPLETION_HPP */
@@ -22,6 +22,7 @@
 #include <ribosome/expiration.hpp>
 #include <ribosome/lstring.hpp>
 
+#include <functional>
 #include <memory>
 #include <string>
 
@@ -37,6 +38,7 @@ struct word_form {
 	ribosome::lstring	lw;
 	float			freq_norm = 0;
 	int			edit_distance = 0; // used when sorting 
+	float			error_cost = 0; // weighted edit distance, used when sorting
 
 	MSGPACK_DEFINE(word, indexed_id, freq, documents);
 
@@ -412,6 +414,88 @@ public:
 		return ribosome::error_info();
 	}
 
+	// Reads all @keys using single MultiGet() call, values of missing keys are left empty
+	ribosome::error_info read(const std::vector<std::string> &keys, std::vector<std::string> *ret) {
+		if (!m_db) {
+			return ribosome::create_error(-EINVAL, "database is not opened");
+		}
+
+		std::vector<rocksdb::Slice> slices;
+		slices.reserve(keys.size());
+		for (const auto &key: keys) {
+			slices.emplace_back(key);
+		}
+
+		auto statuses = m_db->MultiGet(rocksdb::ReadOptions(), slices, ret);
+		for (size_t i = 0; i < statuses.size(); ++i) {
+			const auto &s = statuses[i];
+			if (s.IsNotFound()) {
+				(*ret)[i].clear();
+				continue;
+			}
+
+			if (!s.ok()) {
+				return ribosome::create_error(-s.code(), "could not read key: %s, error: %s",
+						keys[i].c_str(), s.ToString().c_str());
+			}
+		}
+
+		return ribosome::error_info();
+	}
+
+	// Reads word forms for all @keys using single MultiGet() call,
+	// word forms for missing keys have empty word
+	ribosome::error_info read(const std::vector<std::string> &keys, std::vector<word_form> *wfs) {
+		std::vector<std::string> values;
+		auto err = read(keys, &values);
+		if (err)
+			return err;
+
+		wfs->clear();
+		wfs->resize(keys.size());
+
+		for (size_t i = 0; i < values.size(); ++i) {
+			const std::string &val = values[i];
+			if (val.empty())
+				continue;
+
+			err = warp::deserialize((*wfs)[i], val.data(), val.size());
+			if (err) {
+				return ribosome::create_error(err.code(), "could not deserialize word form: %s, error: %s",
+						keys[i].c_str(), err.message().c_str());
+			}
+		}
+
+		return ribosome::error_info();
+	}
+
+	// Calls @func for every key starting with @prefix in key order, iteration stops
+	// when @func returns false. This is full scan and is only suitable for offline tools
+	// and building in-memory indexes at load time.
+	ribosome::error_info iterate(const std::string &prefix,
+			const std::function<bool (const rocksdb::Slice &key, const rocksdb::Slice &value)> &func) {
+		if (!m_db) {
+			return ribosome::create_error(-EINVAL, "database is not opened");
+		}
+
+		rocksdb::ReadOptions ro;
+		ro.fill_cache = false;
+
+		std::unique_ptr<rocksdb::Iterator> it(m_db->NewIterator(ro));
+		rocksdb::Slice pslice(prefix);
+		for (it->Seek(pslice); it->Valid() && it->key().starts_with(pslice); it->Next()) {
+			if (!func(it->key(), it->value()))
+				break;
+		}
+
+		if (!it->status().ok()) {
+			return ribosome::create_error(-it->status().code(), "could not iterate over prefix %s: %s",
+					prefix.c_str(), it->status().ToString().c_str());
+		}
+
+		return ribosome::error_info();
+	}
+
 	ribosome::error_info write(rocksdb::WriteBatch *batch) {
 		if (!m_db) {
 			return ribosome::create_error(-EINVAL, "database is not opened");
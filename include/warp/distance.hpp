@@ -76,6 +76,94 @@ static int levenstein(const S &s, const S &t, int min_dist) {
 	return dist;
 }
 
+/*
+ * Weighted optimal string alignment distance between typed word @s and dictionary word @t.
+ *
+ * @costs provides per-letter costs of every edit operation:
+ *    substitute(typed, intended), insert(intended), remove(typed), transpose(first, second)
+ * Returns negative value as soon as every alignment becomes more expensive than @max_cost,
+ * number of edit operations along the cheapest alignment is stored into @edits if it is not NULL.
+ */
+template <typename S, typename C>
+static float weighted_damerau(const S &s, const S &t, const C &costs, float max_cost, int *edits = NULL) {
+	// three rows of costs (i-2, i-1 and i) and number of edits along the same alignments
+	std::vector<float> v0(t.size() + 1), v1(t.size() + 1), v2(t.size() + 1);
+	std::vector<int> e0(t.size() + 1), e1(t.size() + 1), e2(t.size() + 1);
+
+	v1[0] = 0;
+	e1[0] = 0;
+	for (size_t j = 0; j < t.size(); ++j) {
+		v1[j + 1] = v1[j] + costs.insert(t[j]);
+		e1[j + 1] = j + 1;
+	}
+
+	// transposition reads the row before the previous one, so alignment cost can only be bounded
+	// by the minimum over the last two rows
+	float prev_min = v1[0];
+	for (size_t j = 1; j < v1.size(); ++j)
+		prev_min = std::min(prev_min, v1[j]);
+
+	for (size_t i = 0; i < s.size(); ++i) {
+		v2[0] = v1[0] + costs.remove(s[i]);
+		e2[0] = i + 1;
+
+		float row_min = v2[0];
+
+		for (size_t j = 0; j < t.size(); ++j) {
+			float cost = v1[j];
+			int ops = e1[j];
+			if (!(s[i] == t[j])) {
+				cost += costs.substitute(s[i], t[j]);
+				ops++;
+			}
+
+			float del = v1[j + 1] + costs.remove(s[i]);
+			if (del < cost) {
+				cost = del;
+				ops = e1[j + 1] + 1;
+			}
+
+			float ins = v2[j] + costs.insert(t[j]);
+			if (ins < cost) {
+				cost = ins;
+				ops = e2[j] + 1;
+			}
+
+			if (i > 0 && j > 0 && s[i] == t[j - 1] && s[i - 1] == t[j] && !(s[i] == s[i - 1])) {
+				float tr = v0[j - 1] + costs.transpose(s[i - 1], s[i]);
+				if (tr < cost) {
+					cost = tr;
+					ops = e0[j - 1] + 1;
+				}
+			}
+
+			v2[j + 1] = cost;
+			e2[j + 1] = ops;
+
+			if (cost < row_min)
+				row_min = cost;
+		}
+
+		if (std::min(row_min, prev_min) > max_cost)
+			return -1;
+		prev_min = row_min;
+
+		v0.swap(v1);
+		v1.swap(v2);
+		e0.swap(e1);
+		e1.swap(e2);
+	}
+
+	float dist = v1[t.size()];
+	if (dist > max_cost)
+		return -1;
+
+	if (edits)
+		*edits = e1[t.size()];
+
+	return dist;
+}
+
 }}} // namespace ioremap::warp::distance
 
 #endif /* __WARP_DISTANCE_HPP */
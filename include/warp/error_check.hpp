@@ -1,19 +1,124 @@
 #pragma once
 
+#include "warp/alphabet.hpp"
 #include "warp/json.hpp"
 #include "warp/jsonvalue.hpp"
 #include "warp/language_model.hpp"
+#include "warp/message.hpp"
 #include "warp/thevoid_stream.hpp"
+#include "warp/tokenizer.hpp"
+#include "warp/utf8.hpp"
 
-#include <ribosome/split.hpp>
+#include <memory>
 
 namespace ioremap { namespace warp {
 
+/*
+ * Tokenizes text and checks its words, results are written as array of
+ * {"word", "language", "forms": [{"word", "freq", "similarity"}]} objects.
+ */
+template <typename Server>
+class error_checker {
+public:
+	// @fold enables normalizer::fold_text for words, dictionary must be built with the same folding
+	error_checker(Server *server, int level, int max_num, bool fold) :
+		m_server(server),
+		m_tokenizer(warp::drop_characters, fold ? warp::normalizer::fold_text : 0),
+		m_level(level), m_max_num(max_num) {
+	}
+
+	// words are spans over @text, only their lowercased forms are copied
+	void tokenize(const char *text, size_t size) {
+		m_tokenizer.tokenize(text, size);
+	}
+
+	size_t size() const {
+		return m_tokenizer.tokens().size();
+	}
+
+	// checks tokens [@begin, @end) of the last tokenized text
+	ribosome::error_info check(size_t begin, size_t end,
+			std::vector<check_control> *ctls, std::vector<check_result> *results) {
+		ctls->reserve(end - begin);
+		for (size_t i = begin; i < end; ++i) {
+			const token &t = m_tokenizer.tokens()[i];
+
+			struct check_control ctl;
+			ctl.word.assign(m_tokenizer.data(t), t.norm_size);
+			ctl.lw = warp::utf8::to_lstring(ctl.word);
+			ctl.level = m_level;
+			ctl.max_num = m_max_num;
+
+			ctls->emplace_back(std::move(ctl));
+		}
+
+		return m_server->check_batch(*ctls, results);
+	}
+
+	// checks all words of @text and writes them, nothing is written if checking fails
+	ribosome::error_info write(warp::reply_writer &writer, const char *text, size_t size) {
+		tokenize(text, size);
+
+		std::vector<check_control> ctls;
+		std::vector<check_result> results;
+		auto err = check(0, this->size(), &ctls, &results);
+		if (err)
+			return err;
+
+		write_tokens(writer, ctls, results);
+		return ribosome::error_info();
+	}
+
+	static void write_tokens(warp::reply_writer &writer, const std::vector<check_control> &ctls,
+			std::vector<check_result> &results) {
+		writer.StartArray(ctls.size());
+		for (size_t i = 0; i < ctls.size(); ++i) {
+			const std::string &word = ctls[i].word;
+			const std::string &lang = results[i].language;
+			std::vector<warp::dictionary::word_form> &forms = results[i].forms;
+
+			if (results[i].err) {
+				warp::dictionary::word_form orig;
+				orig.word = word;
+				orig.lw = ctls[i].lw;
+
+				forms.emplace_back(orig);
+			}
+
+			writer.StartObject(3);
+			writer.String("word").String(word);
+			writer.String("language").String(lang);
+
+			writer.String("forms");
+			writer.StartArray(forms.size());
+			for (auto &wf: forms) {
+				writer.StartObject(3);
+				writer.String("word").String(wf.word);
+				writer.String("freq").Int(wf.freq);
+				writer.String("similarity").Double(wf.freq_norm);
+				writer.EndObject();
+			}
+			writer.EndArray();
+
+			writer.EndObject();
+		}
+		writer.EndArray();
+	}
+
+private:
+	Server *m_server;
+	// the same separators as the server uses for other endpoints, so words are looked up without punctuation
+	warp::tokenizer m_tokenizer;
+	int m_level;
+	int m_max_num;
+};
+
 template <typename Server>
 class on_error_check : public thevoid::simple_request_stream_error<Server> {
 public:
 	using thevoid::simple_request_stream_error<Server>::send_error;
 	using thevoid::simple_request_stream_error<Server>::server;
+	using thevoid::simple_request_stream_error<Server>::stats;
 
 	virtual void on_request(const thevoid::http_request &http_req, const boost::asio::const_buffer &buffer) {
 		int level = warp::check_control::level_3;
@@ -27,103 +132,150 @@ public:
 			max_num = atoi((*opt).c_str());
 		}
 
-		rapidjson::Document doc;
+		bool fold = http_req.url().query().has_item("fold");
+
+		stats().endpoint = "error_check";
+		stats().level = level;
+		stats().bytes_in = boost::asio::buffer_size(buffer);
+
 		const char *ptr = boost::asio::buffer_cast<const char*>(buffer);
 		if (!ptr) {
 			send_error(swarm::http_response::bad_request, -EINVAL, "document is empty");
 			return;
 		}
 
-		std::string buf;
-		buf.assign(ptr, boost::asio::buffer_size(buffer));
+		bool stream = http_req.url().query().has_item("stream");
+		bool pretty = http_req.url().query().has_item("pretty");
+		if (!stream) {
+			bool request_msgpack = warp::is_msgpack(http_req.headers().content_type());
+
+			std::string options = std::to_string(level) + "." + std::to_string(max_num) + ".";
+			options.push_back('0' + fold);
+			options.push_back('0' + pretty);
+			options.push_back('0' + request_msgpack);
+			options.push_back('0' + warp::reply_writer::want_msgpack(http_req, request_msgpack));
 
-		doc.Parse<0>(buf.c_str());
-		if (doc.HasParseError()) {
-			send_error(swarm::http_response::bad_request, -EINVAL, "document parsing error: %s, offset: %ld",
-					doc.GetParseError(), doc.GetErrorOffset());
+			if (this->send_cached_reply("error_check", options, ptr, boost::asio::buffer_size(buffer)))
+				return;
+		}
+
+		auto parse_err = m_body.parse(http_req, ptr, boost::asio::buffer_size(buffer));
+		if (parse_err) {
+			send_error(swarm::http_response::bad_request, parse_err.code(), "%s", parse_err.message().c_str());
 			return;
 		}
 
-		warp::JsonValue reply;
-		auto &alloc = reply.GetAllocator();
+		m_checker.reset(new error_checker<Server>(server(), level, max_num, fold));
+
+		bool msgpack = warp::reply_writer::want_msgpack(http_req, m_body.msgpack());
 
-		const auto &req = warp::get_object(doc, "request");
-		if (!req.IsObject()) {
-			send_error(swarm::http_response::bad_request, -ENOENT, "'request' must be object");
+		// ?stream: reply is a sequence of {"name": [tokens]} records, every record holds up to
+		// stream_batch checked tokens of the member and is sent before the next batch is checked
+		if (stream) {
+			this->send_records(warp::record_content_type(msgpack), [this, msgpack] (std::string *record) -> bool {
+						return next_record(record, msgpack);
+					});
 			return;
 		}
 
-		for (auto member_it = req.MemberBegin(), member_end = req.MemberEnd();
-				member_it != member_end; ++member_it) {
-			if (!member_it->value.IsString()) {
-				continue;
+		std::string reply_data;
+		warp::reply_writer writer(reply_data, msgpack, pretty);
+
+		writer.StartObject(m_body.members().size());
+		for (const auto &member: m_body.members()) {
+			writer.String(member.name, member.name_size);
+
+			auto err = m_checker->write(writer, member.value, member.value_size);
+			if (err) {
+				send_error(swarm::http_response::internal_server_error, err.code(),
+						"could not check words: %s", err.message().c_str());
+				return;
 			}
+			stats().tokens += m_checker->size();
+		}
+		writer.EndObject();
+		writer.finish();
 
-			ribosome::lstring text = ribosome::lconvert::from_utf8(member_it->value.GetString(),
-					member_it->value.GetStringLength());
+		this->send_cacheable_reply(writer.content_type(), std::move(reply_data));
+	}
 
-			auto lower_request = ribosome::lconvert::to_lower(text);
-			rapidjson::Value tokens(rapidjson::kArrayType);
+private:
+	enum {
+		stream_batch = 256,
+	};
 
-			ribosome::split spl;
-			auto all_words = spl.convert_split_words(lower_request, "");
-			for (auto &w: all_words) {
-				std::string word = ribosome::lconvert::to_string(w);
-				std::string lang = server()->language(word, w);
+	warp::request_body m_body;
+	std::unique_ptr<error_checker<Server>> m_checker;
 
-				struct check_control ctl;
-				ctl.word = word;
-				ctl.lw = w;
-				ctl.level = level;
-				ctl.max_num = max_num;
+	// streaming position: member whose tokens are in the checker and its next unchecked token
+	size_t m_member = 0;
+	size_t m_token = 0;
+	bool m_tokenized = false;
+	bool m_failed = false;
 
-				std::vector<warp::dictionary::word_form> forms;
+	bool next_record(std::string *record, bool msgpack) {
+		if (m_failed)
+			return false;
 
-				auto err = server()->check(lang, ctl, &forms);
-				if (err) {
-					warp::dictionary::word_form orig;
-					orig.word = word;
-					orig.lw = w;
+		const auto &members = m_body.members();
+		while (m_member < members.size()) {
+			if (!m_tokenized) {
+				m_checker->tokenize(members[m_member].value, members[m_member].value_size);
+				stats().tokens += m_checker->size();
+				m_tokenized = true;
+				m_token = 0;
+			}
 
-					forms.emplace_back(orig);
-				}
+			// empty member still gets its record with empty token array
+			size_t num = m_checker->size();
+			if (m_token < num || (num == 0 && m_token == 0)) {
+				break;
+			}
 
-				rapidjson::Value token(rapidjson::kObjectType);
-				rapidjson::Value wv(word.c_str(), word.size(), alloc);
-				token.AddMember("word", wv, alloc);
-				rapidjson::Value lv(lang.c_str(), lang.size(), alloc);
-				token.AddMember("language", lv, alloc);
+			m_member++;
+			m_tokenized = false;
+		}
 
-				rapidjson::Value wfs(rapidjson::kArrayType);
-				for (auto &wf: forms) {
-					rapidjson::Value fv(rapidjson::kObjectType);
+		if (m_member == members.size())
+			return false;
 
-					rapidjson::Value wv(wf.word.c_str(), wf.word.size(), alloc);
-					fv.AddMember("word", wv, alloc);
-					fv.AddMember("freq", wf.freq, alloc);
-					fv.AddMember("similarity", wf.freq_norm, alloc);
+		const auto &member = members[m_member];
+		size_t end = std::min<size_t>(m_token + stream_batch, m_checker->size());
 
-					wfs.PushBack(fv, alloc);
-				}
+		warp::reply_writer writer(*record, msgpack);
 
-				token.AddMember("forms", wfs, alloc);
-				tokens.PushBack(token, alloc);
-			}
+		std::vector<check_control> ctls;
+		std::vector<check_result> results;
+		auto err = m_checker->check(m_token, end, &ctls, &results);
+		if (err) {
+			// headers have been sent already, error is the last record
+			writer.StartObject(1);
+			writer.String("error");
+			writer.StartObject(2);
+			writer.String("message").String(err.message());
+			writer.String("code").Int(err.code());
+			writer.EndObject();
+			writer.EndObject();
+			writer.finish();
 
-			reply.AddMember(member_it->name.GetString(), alloc, tokens, alloc);
+			m_failed = true;
+			return true;
 		}
 
-		std::string reply_data = reply.ToString();
+		writer.StartObject(1);
+		writer.String(member.name, member.name_size);
+		error_checker<Server>::write_tokens(writer, ctls, results);
+		writer.EndObject();
+		writer.finish();
 
-		thevoid::http_response http_reply;
-		http_reply.set_code(swarm::http_response::ok);
-		http_reply.headers().set_content_length(reply_data.size());
-		http_reply.headers().set_content_type("text/json");
+		m_token = end;
+		if (end == m_checker->size()) {
+			m_member++;
+			m_tokenized = false;
+		}
 
-		this->send_reply(std::move(http_reply), std::move(reply_data));
+		return true;
 	}
-
-private:
 };
 
 
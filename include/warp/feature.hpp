@@ -17,6 +17,8 @@
 #ifndef __WARP_FEATURE_HPP
 #define __WARP_FEATURE_HPP
 
+#include "warp/utf8.hpp"
+
 #include <algorithm>
 #include <atomic>
 #include <fstream>
@@ -187,8 +189,8 @@ struct parsed_word {
 	void msgpack_pack(msgpack::packer<Stream> &o) const {
 		o.pack_array(serialize_version_6);
 		o.pack((int)serialize_version_6);
-		o.pack(ribosome::lconvert::to_string(lemma));
-		o.pack(ribosome::lconvert::to_string(stem));
+		o.pack(warp::utf8::to_string(lemma));
+		o.pack(warp::utf8::to_string(stem));
 		o.pack(indexed_id);
 		o.pack(root_len);
 		o.pack(features);
@@ -220,9 +222,9 @@ struct parsed_word {
 		switch (version) {
 		case serialize_version_6:
 			p[1].convert(&tmp);
-			lemma = ribosome::lconvert::from_utf8(tmp);
+			lemma = warp::utf8::to_lstring(tmp);
 			p[2].convert(&tmp);
-			stem = ribosome::lconvert::from_utf8(tmp);
+			stem = warp::utf8::to_lstring(tmp);
 			p[3].convert(&indexed_id);
 			p[4].convert(&root_len);
 			p[5].convert(&features);
@@ -280,7 +282,7 @@ public:
 		}
 
 		std::string mixed_word = token.substr(1, space_pos - 1);
-		ribosome::lstring lw = ribosome::lconvert::from_utf8(mixed_word);
+		ribosome::lstring lw = warp::utf8::to_lstring(mixed_word);
 
 		size_t root_end = lw.find(']');
 		if (root_end == ribosome::lstring::npos) {
@@ -301,9 +303,9 @@ public:
 		if (!(f.mask & m_pass_mask))
 			return err;
 
-		//std::cout << "parse: " << ribosome::lconvert::to_string(lw) << ": " << elm_string << ", feaures: " << std::hex << f.mask << std::endl;
+		//std::cout << "parse: " << warp::utf8::to_string(lw) << ": " << elm_string << ", feaures: " << std::hex << f.mask << std::endl;
 		f.ending = lw.substr(lw.size() - ending_len);
-		f.string_ending = ribosome::lconvert::to_string(f.ending);
+		f.string_ending = warp::utf8::to_string(f.ending);
 
 		m_current.root_len = root_end;
 		m_current.features.emplace_back(f);
@@ -354,7 +356,7 @@ public:
 				m_current.reset();
 
 				// next line contains lemma word
-				auto l = ribosome::lconvert::from_utf8(line);
+				auto l = warp::utf8::to_lstring(line);
 				read_lemma = true;
 
 				m_current.lemma = ribosome::lconvert::to_lower(l);
@@ -2,17 +2,21 @@
 #define __FUZZY_FUZZY_HPP
 
 #include "warp/database.hpp"
+#include "warp/distance.hpp"
 #include "warp/ngram.hpp"
 #include "warp/norvig.hpp"
 #include "warp/substring.hpp"
+#include "warp/utf8.hpp"
 
-#include <ribosome/distance.hpp>
 #include <ribosome/error.hpp>
 #include <ribosome/lstring.hpp>
 #include <ribosome/timer.hpp>
 
 #include <msgpack.hpp>
 
+#include <cmath>
+#include <tuple>
+
 namespace ioremap { namespace warp {
 
 struct check_control {
@@ -30,6 +34,66 @@ struct check_control {
 	int level = level_3;
 };
 
+struct check_result {
+	std::string language;
+	ribosome::error_info err;
+	std::vector<dictionary::word_form> forms;
+};
+
+
+// Noisy channel ranking: candidate probability is its smoothed dictionary frequency
+// multiplied by probability of the typo, which decays exponentially with weighted
+// edit distance computed from error model costs, @channel_weight sets how fast.
+static inline std::vector<dictionary::word_form> noisy_channel_sort(const ribosome::lstring &lw,
+		const std::vector<dictionary::word_form> &words, const error_model::letter_error_model &emod,
+		float channel_weight, int max_num) {
+	std::vector<dictionary::word_form> ret;
+	ret.reserve(words.size());
+
+	float max_cost = lw.size() / 2;
+	float min_cost = max_cost;
+	for (auto &wf: words) {
+		int edits = 0;
+		float cost = distance::weighted_damerau(lw, wf.lw, emod, max_cost, &edits);
+		if (cost < 0) {
+			continue;
+		}
+		if (cost < min_cost) {
+			min_cost = cost;
+		}
+
+		dictionary::word_form tmp = wf;
+		tmp.edit_distance = edits;
+		tmp.error_cost = cost;
+		ret.emplace_back(tmp);
+	}
+
+	// candidates which require at least one more arbitrary edit than the best one can not win
+	float cost_bound = min_cost + emod.edit_costs().substitute;
+	ret.erase(std::remove_if(ret.begin(), ret.end(), [&] (const dictionary::word_form &wf) {
+				return wf.error_cost > cost_bound;
+			}), ret.end());
+
+	long sum_freq = 0;
+	for (auto &wf: ret) {
+		sum_freq += wf.freq;
+	}
+
+	for (auto &wf: ret) {
+		float f = (float)(wf.freq + 1) / (float)(sum_freq + ret.size());
+		wf.freq_norm = f * std::exp(-channel_weight * wf.error_cost);
+	}
+
+	std::sort(ret.begin(), ret.end(), [&] (const dictionary::word_form &wf1, const dictionary::word_form &wf2) {
+				if (wf1.freq_norm != wf2.freq_norm)
+					return wf1.freq_norm > wf2.freq_norm;
+				return wf1.freq > wf2.freq;
+			});
+
+	if ((int)ret.size() > max_num)
+		ret.resize(max_num);
+	return ret;
+}
 
 class checker {
 public:
@@ -56,52 +120,155 @@ public:
 	}
 
 	ribosome::error_info check(const check_control &ctl, std::vector<dictionary::word_form> *ret) {
-		ribosome::error_info err;
-		if (ctl.word.empty())
+		std::vector<check_result> results;
+		auto err = check_batch(std::vector<check_control>({ctl}), &results);
+		if (err)
 			return err;
 
-		dictionary::word_form wf;
-		err = read_word(ctl.word, &wf);
-		if (wf.word.size()) {
-			ret->push_back(wf);
-			return err;
+		check_result &res = results.front();
+		ret->insert(ret->end(), res.forms.begin(), res.forms.end());
+		return res.err;
+	}
+
+	// Exact dictionary lookup of all @words using single MultiGet() call,
+	// word forms of missing words have empty word
+	ribosome::error_info lookup(const std::vector<std::string> &words, std::vector<dictionary::word_form> *ret) {
+		std::vector<std::string> keys;
+		keys.reserve(words.size());
+		for (const auto &word: words) {
+			keys.emplace_back(m_db.options().word_form_prefix + word);
 		}
-		if (ctl.level == check_control::level_0) {
+
+		auto err = m_db.read(keys, ret);
+		if (err)
 			return err;
+
+		for (auto &wf: *ret) {
+			if (wf.word.size())
+				wf.lw = warp::utf8::to_lstring(wf.word);
 		}
 
-		err = read_transform(ctl.word, &wf);
-		if (wf.word.size()) {
-			ret->push_back(wf);
-			return err;
+		return ribosome::error_info();
+	}
+
+	// Calls @func for every word in the dictionary, iteration stops when @func returns false
+	ribosome::error_info for_each_word(const std::function<bool (const char *word, size_t size)> &func) {
+		const std::string &prefix = m_db.options().word_form_prefix;
+		return m_db.iterate(prefix, [&] (const rocksdb::Slice &key, const rocksdb::Slice &) -> bool {
+					return func(key.data() + prefix.size(), key.size() - prefix.size());
+				});
+	}
+
+	// Checks all words at once: every check level reads all keys it needs with single MultiGet,
+	// Norvig candidates of all words which reach that level are probed in shared batches.
+	// @ret contains result for every control in the same order, error of a single word is stored
+	// in its result and other words are still checked, returned error is only set if dictionary
+	// could not be read for the whole batch.
+	ribosome::error_info check_batch(const std::vector<check_control> &ctls, std::vector<check_result> *ret) {
+		ret->clear();
+		ret->resize(ctls.size());
+
+		// the same word checked with the same parameters is only processed once
+		std::map<std::tuple<std::string, int, int>, size_t> unique;
+		std::vector<size_t> owner(ctls.size());
+		std::vector<size_t> pending;
+		for (size_t i = 0; i < ctls.size(); ++i) {
+			const auto &ctl = ctls[i];
+			if (ctl.word.empty())
+				continue;
+
+			auto p = unique.emplace(std::make_tuple(ctl.word, ctl.level, ctl.max_num), i);
+			owner[i] = p.first->second;
+			if (p.second) {
+				pending.push_back(i);
+			}
 		}
 
-		if (ctl.level == check_control::level_1) {
+		auto lookup = [&] (const std::string &prefix, int last_level) -> ribosome::error_info {
+			std::vector<std::string> keys;
+			keys.reserve(pending.size());
+			for (auto idx: pending) {
+				keys.emplace_back(prefix + ctls[idx].word);
+			}
+
+			std::vector<dictionary::word_form> wfs;
+			auto err = m_db.read(keys, &wfs);
+			if (err)
+				return err;
+
+			std::vector<size_t> misses;
+			for (size_t i = 0; i < pending.size(); ++i) {
+				size_t idx = pending[i];
+				dictionary::word_form &wf = wfs[i];
+				check_result &res = (*ret)[idx];
+
+				if (wf.word.size()) {
+					wf.lw = warp::utf8::to_lstring(wf.word);
+					res.forms.emplace_back(std::move(wf));
+				} else if (ctls[idx].level <= last_level) {
+					res.err = ribosome::create_error(-ENOENT, "could not read key: %s", keys[i].c_str());
+				} else {
+					misses.push_back(idx);
+				}
+			}
+
+			pending.swap(misses);
+			return ribosome::error_info();
+		};
+
+		auto err = lookup(m_db.options().word_form_prefix, check_control::level_0);
+		if (err)
 			return err;
-		}
 
-		std::vector<dictionary::word_form> tmp;
-		err = norvig_check(ctl.word, ctl.lw, &tmp);
-		if (err) {
+		err = lookup(m_db.options().transform_prefix, check_control::level_1);
+		if (err)
 			return err;
+
+		std::vector<const ribosome::lstring *> lws;
+		lws.reserve(pending.size());
+		for (auto idx: pending) {
+			lws.push_back(&ctls[idx].lw);
 		}
 
-		if (tmp.empty() && (ctl.level >= check_control::level_3)) {
-			err = ngram_check(ctl.word, ctl.lw, &tmp);
-			if (err) {
-				return err;
+		std::vector<std::vector<dictionary::word_form>> candidates;
+		std::vector<ribosome::error_info> errors;
+		norvig_check(lws, &candidates, &errors);
+
+		for (size_t i = 0; i < pending.size(); ++i) {
+			const check_control &ctl = ctls[pending[i]];
+			check_result &res = (*ret)[pending[i]];
+			auto &tmp = candidates[i];
+
+			if (errors[i]) {
+				res.err = errors[i];
+				continue;
 			}
+
+			if (tmp.empty() && (ctl.level >= check_control::level_3)) {
+				err = ngram_check(ctl.word, ctl.lw, &tmp);
+				if (err) {
+					res.err = err;
+					continue;
+				}
+			}
+
+			res.forms = sort(ctl.lw, tmp, ctl.max_num);
 		}
 
-		*ret = sort(ctl.lw, tmp, ctl.max_num);
-		return err;
+		for (size_t i = 0; i < ctls.size(); ++i) {
+			if (owner[i] != i && !ctls[i].word.empty()) {
+				(*ret)[i] = (*ret)[owner[i]];
+			}
+		}
+
+		return ribosome::error_info();
 	}
 
 	ribosome::error_info check(const std::string &word, std::vector<dictionary::word_form> *ret) {
 		struct check_control ctl;
 
 		ctl.word = word;
-		ctl.lw = ribosome::lconvert::from_utf8(word);
+		ctl.lw = warp::utf8::to_lstring(word);
 		ctl.lw = ribosome::lconvert::to_lower(ctl.lw);
 
 		return check(ctl, ret);
@@ -121,27 +288,11 @@ private:
 	norvig::lang_model m_model;
 	int m_ngram = 2;
 
-	ribosome::error_info read_word(const std::string &word, dictionary::word_form *wf) {
-		std::string key = m_db.options().word_form_prefix + word;
-		auto err = m_db.read(key, wf);
-		if (err) {
-			return err;
-		}
+	// number of Norvig candidates read from database with single MultiGet() call
+	size_t m_probe_batch = 1024;
 
-		wf->lw = ribosome::lconvert::from_utf8(wf->word);
-		return ribosome::error_info();
-	}
-
-	ribosome::error_info read_transform(const std::string &word, dictionary::word_form *wf) {
-		std::string key = m_db.options().transform_prefix + word;
-		auto err = m_db.read(key, wf);
-		if (err) {
-			return err;
-		}
-
-		wf->lw = ribosome::lconvert::from_utf8(wf->word);
-		return ribosome::error_info();
-	}
+	// how fast typo probability decays with weighted edit distance
+	float m_channel_weight = 4;
 
 	ribosome::error_info read_word_by_id(const dictionary::document_for_index &did, dictionary::word_form *wf) {
 		std::string wkey = m_db.options().word_form_indexed_prefix + std::to_string(did.indexed_id);
@@ -160,7 +311,7 @@ private:
 					did.indexed_id, err.message().c_str());
 		}
 
-		wf->lw = ribosome::lconvert::from_utf8(wf->word);
+		wf->lw = warp::utf8::to_lstring(wf->word);
 
 		return ribosome::error_info();
 	}
@@ -182,36 +333,65 @@ private:
 		return ribosome::error_info();
 	}
 
-	ribosome::error_info norvig_check(const std::string &word, const ribosome::lstring &lw, std::vector<dictionary::word_form> *ret) {
-		(void) word;
+	// Generates Norvig candidates for every word and probes them in batches,
+	// candidates of different words share the same MultiGet() call
+	// Candidates of every word in @lws, @errors is set for words whose candidates could not be read,
+	// failed probe only affects words which had keys in it
+	void norvig_check(const std::vector<const ribosome::lstring *> &lws,
+			std::vector<std::vector<dictionary::word_form>> *ret, std::vector<ribosome::error_info> *errors) {
+		std::vector<std::set<dictionary::word_form>> wfs(lws.size());
+		errors->clear();
+		errors->resize(lws.size());
+
+		std::vector<std::string> keys;
+		std::vector<std::pair<size_t, int>> owners; // (word index, edit distance) for every key
+		std::vector<dictionary::word_form> found;
+
+		auto flush = [&] () {
+			auto err = m_db.read(keys, &found);
+			if (err) {
+				for (const auto &o: owners) {
+					if (!(*errors)[o.first])
+						(*errors)[o.first] = err;
+				}
+			} else {
+				for (size_t i = 0; i < found.size(); ++i) {
+					dictionary::word_form &wf = found[i];
+					if (wf.word.empty())
+						continue;
+
+					wf.lw = warp::utf8::to_lstring(wf.word);
+					wf.edit_distance = owners[i].second;
+					wfs[owners[i].first].insert(wf);
+				}
+			}
+
+			keys.clear();
+			owners.clear();
+		};
 
-		std::set<dictionary::word_form> wfs;
-		ribosome::error_info err;
-		dictionary::word_form wf;
+		for (size_t idx = 0; idx < lws.size(); ++idx) {
+			m_model.for_each_edit(*lws[idx], 2, [&] (const ribosome::letter *ptr, size_t size, int distance) -> bool {
+						keys.emplace_back(m_db.options().word_form_prefix +
+								warp::utf8::to_string(ptr, size));
+						owners.emplace_back(idx, distance);
 
-		std::set<ribosome::lstring> e1 = m_model.edits1(lw);
-		for (const auto &w1: e1) {
-			std::string w = ribosome::lconvert::to_string(w1);
-			err = read_word(w, &wf);
-			if (wf.word.size()) {
-				wf.edit_distance = 1;
-				wfs.insert(wf);
-			}
-		}
+						if (keys.size() >= m_probe_batch)
+							flush();
 
-		for (const auto &w1: e1) {
-			for (const auto &w2: m_model.edits1(w1)) {
-				std::string w = ribosome::lconvert::to_string(w2);
-				err = read_word(w, &wf);
-				if (wf.word.size()) {
-					wf.edit_distance = 2;
-					wfs.insert(wf);
-				}
-			}
+						return true;
+					});
 		}
 
-		ret->insert(ret->end(), wfs.begin(), wfs.end());
-		return ribosome::error_info();
+		if (keys.size())
+			flush();
+
+		ret->clear();
+		ret->resize(lws.size());
+		for (size_t i = 0; i < wfs.size(); ++i) {
+			if (!(*errors)[i])
+				(*ret)[i].assign(wfs[i].begin(), wfs[i].end());
+		}
 	}
 
 	ribosome::error_info ngram_check(const std::string &word, const ribosome::lstring &lw, std::vector<dictionary::word_form> *ret) {
@@ -220,7 +400,7 @@ private:
 		std::map<uint64_t, size_t> idc;
 
 		for (auto &n: ngrams) {
-			std::string ns = ribosome::lconvert::to_string(n);
+			std::string ns = warp::utf8::to_string(n);
 			std::string key = m_db.options().ngram_prefix + ns;
 
 			std::string nlist;
@@ -265,46 +445,7 @@ private:
 	}
 
 	std::vector<dictionary::word_form> sort(const ribosome::lstring &lw, const std::vector<dictionary::word_form> &words, int max_num) {
-		std::vector<dictionary::word_form> ret;
-		ret.reserve(words.size());
-
-		long sum_freq = 0;
-		int min_dist = lw.size() / 2;
-		for (auto &wf: words) {
-			int edit_distance = ribosome::distance::levenstein(lw, wf.lw, min_dist);
-			if (edit_distance < 0) {
-				continue;
-			}
-			if (edit_distance < min_dist) {
-				min_dist = edit_distance;
-			}
-
-			sum_freq += wf.freq;
-
-			dictionary::word_form tmp = wf;
-			tmp.edit_distance = edit_distance;
-			ret.emplace_back(tmp);
-		}
-
-		for (auto &wf: ret) {
-			float f = (float)wf.freq / (float)sum_freq;
-			float d = (float)wf.edit_distance / (float)wf.lw.size();
-			ribosome::lstring sub = longest_substring(lw, wf.lw);
-			size_t diff = lw.size() - sub.size();
-			if (diff == 0) {
-				wf.freq_norm = f / d;
-			} else {
-				wf.freq_norm = f / d / (diff * 10.0);
-			}
-		}
-
-		std::sort(ret.begin(), ret.end(), [&] (const dictionary::word_form &wf1, const dictionary::word_form &wf2) {
-					return wf1.freq_norm >= wf2.freq_norm;
-				});
-
-		if ((int)ret.size() > max_num)
-			ret.resize(max_num);
-		return ret;
+		return noisy_channel_sort(lw, words, m_model.error_model(), m_channel_weight, max_num);
 	}
 };
 
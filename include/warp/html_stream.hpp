@@ -0,0 +1,286 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_HTML_STREAM_HPP
+#define __WARP_HTML_STREAM_HPP
+
+#include "warp/utf8.hpp"
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Incremental HTML to text converter, document is fed in arbitrary chunks and the state
+ * (open tag, comment, entity, script or style body) is kept between them, so memory
+ * does not depend on document size.
+ *
+ * Every tag is replaced with single space, comments and bodies of <script> and <style>
+ * are dropped, numeric entities and named entities of HTML 4 (plus &apos;) are decoded,
+ * unknown entities are replaced with space.
+ */
+class html_stripper {
+public:
+	// Appends text of the next @size bytes of document to @text
+	void feed(const char *data, size_t size, std::string *text) {
+		for (size_t i = 0; i < size; ++i) {
+			char c = data[i];
+
+			switch (m_state) {
+			case state_text:
+				if (c == '<') {
+					m_state = state_tag;
+					m_tag.clear();
+					m_tag_name_done = false;
+					m_quote = 0;
+				} else if (c == '&') {
+					m_state = state_entity;
+					m_entity.clear();
+				} else {
+					text->push_back(c);
+				}
+				break;
+			case state_tag:
+				if (m_tag.empty() && !m_tag_name_done && !isalpha((unsigned char)c) && c != '/' && c != '!') {
+					// not a tag, like in "a < b"
+					text->push_back('<');
+					m_state = state_text;
+					--i;
+					break;
+				}
+
+				tag_char(c, text);
+				break;
+			case state_comment:
+				if (c == '>' && m_dashes >= 2) {
+					m_state = state_text;
+					text->push_back(' ');
+				}
+				m_dashes = (c == '-') ? m_dashes + 1 : 0;
+				break;
+			case state_raw:
+				raw_char(c);
+				break;
+			case state_entity:
+				if (c == ';') {
+					decode_entity(text);
+					m_state = state_text;
+				} else if ((isalnum((unsigned char)c) || c == '#') && m_entity.size() < max_entity) {
+					m_entity.push_back(c);
+				} else {
+					// not an entity, emit it as is and process current character as text
+					text->push_back('&');
+					text->append(m_entity);
+					m_state = state_text;
+					--i;
+				}
+				break;
+			}
+		}
+	}
+
+	// Flushes pending entity at the end of document
+	void finish(std::string *text) {
+		if (m_state == state_entity) {
+			text->push_back('&');
+			text->append(m_entity);
+		}
+
+		m_state = state_text;
+	}
+
+private:
+	enum {
+		state_text = 0,
+		state_tag,
+		state_comment,
+		state_raw,
+		state_entity,
+	};
+
+	static const size_t max_tag = 16;
+	static const size_t max_entity = 10;
+
+	int m_state = state_text;
+
+	std::string m_tag;
+	bool m_tag_name_done = false;
+	char m_quote = 0;
+
+	int m_dashes = 0;
+
+	// closing tag of <script> or <style> body and number of its matched characters
+	const char *m_raw_end = NULL;
+	size_t m_raw_matched = 0;
+
+	std::string m_entity;
+
+	void tag_char(char c, std::string *text) {
+		if (!m_tag_name_done) {
+			if (c == '>' || isspace((unsigned char)c) || m_tag.size() >= max_tag) {
+				m_tag_name_done = true;
+			} else {
+				m_tag.push_back(tolower((unsigned char)c));
+				if (m_tag == "!--") {
+					m_state = state_comment;
+					m_dashes = 0;
+				}
+				return;
+			}
+		}
+
+		if (m_quote) {
+			if (c == m_quote)
+				m_quote = 0;
+			return;
+		}
+
+		if (c == '"' || c == '\'') {
+			m_quote = c;
+			return;
+		}
+
+		if (c != '>')
+			return;
+
+		text->push_back(' ');
+		m_state = state_text;
+
+		if (m_tag == "script") {
+			m_raw_end = "</script";
+		} else if (m_tag == "style") {
+			m_raw_end = "</style";
+		} else {
+			return;
+		}
+
+		m_state = state_raw;
+		m_raw_matched = 0;
+	}
+
+	void raw_char(char c) {
+		char lc = tolower((unsigned char)c);
+		if (lc == m_raw_end[m_raw_matched]) {
+			if (m_raw_end[++m_raw_matched] == '\0') {
+				// the rest of the closing tag is processed as usual tag
+				m_state = state_tag;
+				m_tag = m_raw_end + 1;
+				m_tag_name_done = true;
+				m_quote = 0;
+			}
+			return;
+		}
+
+		m_raw_matched = (lc == '<') ? 1 : 0;
+	}
+
+	static uint32_t named_entity(const std::string &name) {
+		struct entity {
+			const char	*name;
+			uint32_t	code;
+		};
+
+		// sorted by name
+		static const entity entities[] = {
+			{"AElig", 0xc6}, {"Aacute", 0xc1}, {"Acirc", 0xc2}, {"Agrave", 0xc0}, {"Alpha", 0x391}, {"Aring", 0xc5},
+			{"Atilde", 0xc3}, {"Auml", 0xc4}, {"Beta", 0x392}, {"Ccedil", 0xc7}, {"Chi", 0x3a7}, {"Dagger", 0x2021},
+			{"Delta", 0x394}, {"ETH", 0xd0}, {"Eacute", 0xc9}, {"Ecirc", 0xca}, {"Egrave", 0xc8}, {"Epsilon", 0x395},
+			{"Eta", 0x397}, {"Euml", 0xcb}, {"Gamma", 0x393}, {"Iacute", 0xcd}, {"Icirc", 0xce}, {"Igrave", 0xcc},
+			{"Iota", 0x399}, {"Iuml", 0xcf}, {"Kappa", 0x39a}, {"Lambda", 0x39b}, {"Mu", 0x39c}, {"Ntilde", 0xd1},
+			{"Nu", 0x39d}, {"OElig", 0x152}, {"Oacute", 0xd3}, {"Ocirc", 0xd4}, {"Ograve", 0xd2}, {"Omega", 0x3a9},
+			{"Omicron", 0x39f}, {"Oslash", 0xd8}, {"Otilde", 0xd5}, {"Ouml", 0xd6}, {"Phi", 0x3a6}, {"Pi", 0x3a0},
+			{"Prime", 0x2033}, {"Psi", 0x3a8}, {"Rho", 0x3a1}, {"Scaron", 0x160}, {"Sigma", 0x3a3}, {"THORN", 0xde},
+			{"Tau", 0x3a4}, {"Theta", 0x398}, {"Uacute", 0xda}, {"Ucirc", 0xdb}, {"Ugrave", 0xd9}, {"Upsilon", 0x3a5},
+			{"Uuml", 0xdc}, {"Xi", 0x39e}, {"Yacute", 0xdd}, {"Yuml", 0x178}, {"Zeta", 0x396}, {"aacute", 0xe1},
+			{"acirc", 0xe2}, {"acute", 0xb4}, {"aelig", 0xe6}, {"agrave", 0xe0}, {"alefsym", 0x2135}, {"alpha", 0x3b1},
+			{"amp", 0x26}, {"apos", 0x27}, {"and", 0x2227}, {"ang", 0x2220}, {"aring", 0xe5}, {"asymp", 0x2248}, {"atilde", 0xe3},
+			{"auml", 0xe4}, {"bdquo", 0x201e}, {"beta", 0x3b2}, {"brvbar", 0xa6}, {"bull", 0x2022}, {"cap", 0x2229},
+			{"ccedil", 0xe7}, {"cedil", 0xb8}, {"cent", 0xa2}, {"chi", 0x3c7}, {"circ", 0x2c6}, {"clubs", 0x2663},
+			{"cong", 0x2245}, {"copy", 0xa9}, {"crarr", 0x21b5}, {"cup", 0x222a}, {"curren", 0xa4}, {"dArr", 0x21d3},
+			{"dagger", 0x2020}, {"darr", 0x2193}, {"deg", 0xb0}, {"delta", 0x3b4}, {"diams", 0x2666}, {"divide", 0xf7},
+			{"eacute", 0xe9}, {"ecirc", 0xea}, {"egrave", 0xe8}, {"empty", 0x2205}, {"emsp", 0x2003}, {"ensp", 0x2002},
+			{"epsilon", 0x3b5}, {"equiv", 0x2261}, {"eta", 0x3b7}, {"eth", 0xf0}, {"euml", 0xeb}, {"euro", 0x20ac},
+			{"exist", 0x2203}, {"fnof", 0x192}, {"forall", 0x2200}, {"frac12", 0xbd}, {"frac14", 0xbc},
+			{"frac34", 0xbe}, {"frasl", 0x2044}, {"gamma", 0x3b3}, {"ge", 0x2265}, {"gt", 0x3e}, {"hArr", 0x21d4},
+			{"harr", 0x2194}, {"hearts", 0x2665}, {"hellip", 0x2026}, {"iacute", 0xed}, {"icirc", 0xee},
+			{"iexcl", 0xa1}, {"igrave", 0xec}, {"image", 0x2111}, {"infin", 0x221e}, {"int", 0x222b}, {"iota", 0x3b9},
+			{"iquest", 0xbf}, {"isin", 0x2208}, {"iuml", 0xef}, {"kappa", 0x3ba}, {"lArr", 0x21d0}, {"lambda", 0x3bb},
+			{"lang", 0x2329}, {"laquo", 0xab}, {"larr", 0x2190}, {"lceil", 0x2308}, {"ldquo", 0x201c}, {"le", 0x2264},
+			{"lfloor", 0x230a}, {"lowast", 0x2217}, {"loz", 0x25ca}, {"lrm", 0x200e}, {"lsaquo", 0x2039},
+			{"lsquo", 0x2018}, {"lt", 0x3c}, {"macr", 0xaf}, {"mdash", 0x2014}, {"micro", 0xb5}, {"middot", 0xb7},
+			{"minus", 0x2212}, {"mu", 0x3bc}, {"nabla", 0x2207}, {"nbsp", 0xa0}, {"ndash", 0x2013}, {"ne", 0x2260},
+			{"ni", 0x220b}, {"not", 0xac}, {"notin", 0x2209}, {"nsub", 0x2284}, {"ntilde", 0xf1}, {"nu", 0x3bd},
+			{"oacute", 0xf3}, {"ocirc", 0xf4}, {"oelig", 0x153}, {"ograve", 0xf2}, {"oline", 0x203e}, {"omega", 0x3c9},
+			{"omicron", 0x3bf}, {"oplus", 0x2295}, {"or", 0x2228}, {"ordf", 0xaa}, {"ordm", 0xba}, {"oslash", 0xf8},
+			{"otilde", 0xf5}, {"otimes", 0x2297}, {"ouml", 0xf6}, {"para", 0xb6}, {"part", 0x2202}, {"permil", 0x2030},
+			{"perp", 0x22a5}, {"phi", 0x3c6}, {"pi", 0x3c0}, {"piv", 0x3d6}, {"plusmn", 0xb1}, {"pound", 0xa3},
+			{"prime", 0x2032}, {"prod", 0x220f}, {"prop", 0x221d}, {"psi", 0x3c8}, {"quot", 0x22}, {"rArr", 0x21d2},
+			{"radic", 0x221a}, {"rang", 0x232a}, {"raquo", 0xbb}, {"rarr", 0x2192}, {"rceil", 0x2309},
+			{"rdquo", 0x201d}, {"real", 0x211c}, {"reg", 0xae}, {"rfloor", 0x230b}, {"rho", 0x3c1}, {"rlm", 0x200f},
+			{"rsaquo", 0x203a}, {"rsquo", 0x2019}, {"sbquo", 0x201a}, {"scaron", 0x161}, {"sdot", 0x22c5},
+			{"sect", 0xa7}, {"shy", 0xad}, {"sigma", 0x3c3}, {"sigmaf", 0x3c2}, {"sim", 0x223c}, {"spades", 0x2660},
+			{"sub", 0x2282}, {"sube", 0x2286}, {"sum", 0x2211}, {"sup", 0x2283}, {"sup1", 0xb9}, {"sup2", 0xb2},
+			{"sup3", 0xb3}, {"supe", 0x2287}, {"szlig", 0xdf}, {"tau", 0x3c4}, {"there4", 0x2234}, {"theta", 0x3b8},
+			{"thetasym", 0x3d1}, {"thinsp", 0x2009}, {"thorn", 0xfe}, {"tilde", 0x2dc}, {"times", 0xd7},
+			{"trade", 0x2122}, {"uArr", 0x21d1}, {"uacute", 0xfa}, {"uarr", 0x2191}, {"ucirc", 0xfb}, {"ugrave", 0xf9},
+			{"uml", 0xa8}, {"upsih", 0x3d2}, {"upsilon", 0x3c5}, {"uuml", 0xfc}, {"weierp", 0x2118}, {"xi", 0x3be},
+			{"yacute", 0xfd}, {"yen", 0xa5}, {"yuml", 0xff}, {"zeta", 0x3b6}, {"zwj", 0x200d}, {"zwnj", 0x200c},
+		};
+
+		size_t lo = 0, hi = sizeof(entities) / sizeof(entities[0]);
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			int cmp = strcmp(entities[mid].name, name.c_str());
+			if (cmp == 0)
+				return entities[mid].code;
+
+			if (cmp < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		return 0;
+	}
+
+	void decode_entity(std::string *text) {
+		uint32_t code = 0;
+
+		if (m_entity.size() > 1 && m_entity[0] == '#') {
+			if (m_entity[1] == 'x' || m_entity[1] == 'X')
+				code = strtoul(m_entity.c_str() + 2, NULL, 16);
+			else
+				code = strtoul(m_entity.c_str() + 1, NULL, 10);
+		} else {
+			code = named_entity(m_entity);
+		}
+
+		if (code == 0) {
+			text->push_back(' ');
+			return;
+		}
+
+		char tmp[4];
+		text->append(tmp, utf8::encode_one(code, tmp));
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_HTML_STREAM_HPP */
@@ -4,6 +4,9 @@
 #include <thevoid/rapidjson/document.h>
 
 #include <stdint.h>
+#include <string.h>
+
+#include <vector>
 
 namespace ioremap { namespace warp {
 
@@ -38,8 +41,14 @@ static inline int64_t get_int64(const rapidjson::Value &entry, const char *name,
 	return def;
 }
 
+// default of get_object() and get_array(), it outlives the returned reference unlike a temporary
+static inline const rapidjson::Value &null_value() {
+	static const rapidjson::Value null;
+	return null;
+}
+
 static inline const rapidjson::Value &get_object(const rapidjson::Value &entry, const char *name,
-		const rapidjson::Value &def = rapidjson::Value()) {
+		const rapidjson::Value &def = null_value()) {
 	if (entry.HasMember(name)) {
 		const rapidjson::Value &v = entry[name];
 
@@ -51,7 +60,7 @@ static inline const rapidjson::Value &get_object(const rapidjson::Value &entry,
 }
 
 static inline const rapidjson::Value &get_array(const rapidjson::Value &entry, const char *name,
-		const rapidjson::Value &def = rapidjson::Value()) {
+		const rapidjson::Value &def = null_value()) {
 	if (entry.HasMember(name)) {
 		const rapidjson::Value &v = entry[name];
 
@@ -73,6 +82,39 @@ static inline bool get_bool(const rapidjson::Value &entry, const char *name, boo
 	return def;
 }
 
+/*
+ * Request body parsed in place: body is copied once into mutable buffer and string values
+ * of the document point into that buffer instead of being allocated and copied by rapidjson.
+ * Document nodes are allocated from memory pool whose first chunk is a part of this object,
+ * so small requests do not allocate at all. Document is valid while this object is alive.
+ */
+class insitu_document {
+public:
+	insitu_document() : m_allocator(m_chunk, sizeof(m_chunk)), m_doc(&m_allocator) {
+	}
+	insitu_document(const insitu_document &) = delete;
+	insitu_document &operator=(const insitu_document &) = delete;
+
+	rapidjson::Document &parse(const char *data, size_t size) {
+		m_buffer.resize(size + 1);
+		memcpy(m_buffer.data(), data, size);
+		m_buffer[size] = '\0';
+
+		m_doc.ParseInsitu<0>(m_buffer.data());
+		return m_doc;
+	}
+
+	rapidjson::Document &doc() {
+		return m_doc;
+	}
+
+private:
+	uint64_t m_chunk[2048];
+	rapidjson::MemoryPoolAllocator<> m_allocator;
+	std::vector<char> m_buffer;
+	rapidjson::Document m_doc;
+};
+
 }} // namespace ioremap::greylock
 
 #endif // __INDEXES_JSON_HPP
@@ -2,14 +2,112 @@
 
 #include <thevoid/rapidjson/stringbuffer.h>
 #include <thevoid/rapidjson/prettywriter.h>
+#include <thevoid/rapidjson/writer.h>
 #include <thevoid/rapidjson/document.h>
 
 #include <string>
 
+#include <string.h>
 #include <time.h>
 
 namespace ioremap { namespace warp {
 
+// rapidjson and msgpack output stream which appends to std::string
+class string_stream {
+public:
+	typedef char Ch;
+
+	string_stream(std::string &out) : m_out(out) {}
+
+	void Put(char c) {
+		m_out.push_back(c);
+	}
+
+	void Flush() {
+	}
+
+	void write(const char *data, size_t size) {
+		m_out.append(data, size);
+	}
+
+private:
+	std::string &m_out;
+};
+
+/*
+ * SAX writer which streams JSON straight into the reply string,
+ * output is compact unless @pretty is set.
+ *
+ * It implements rapidjson handler interface, so it also can be passed to Value::Accept().
+ */
+class JsonWriter {
+public:
+	JsonWriter(std::string &out, bool pretty = false) :
+		m_stream(out), m_writer(m_stream), m_pretty_writer(m_stream), m_pretty(pretty) {
+	}
+
+	JsonWriter &Null() {
+		if (m_pretty) m_pretty_writer.Null(); else m_writer.Null();
+		return *this;
+	}
+	JsonWriter &Bool(bool b) {
+		if (m_pretty) m_pretty_writer.Bool(b); else m_writer.Bool(b);
+		return *this;
+	}
+	JsonWriter &Int(int i) {
+		if (m_pretty) m_pretty_writer.Int(i); else m_writer.Int(i);
+		return *this;
+	}
+	JsonWriter &Uint(unsigned u) {
+		if (m_pretty) m_pretty_writer.Uint(u); else m_writer.Uint(u);
+		return *this;
+	}
+	JsonWriter &Int64(int64_t i) {
+		if (m_pretty) m_pretty_writer.Int64(i); else m_writer.Int64(i);
+		return *this;
+	}
+	JsonWriter &Uint64(uint64_t u) {
+		if (m_pretty) m_pretty_writer.Uint64(u); else m_writer.Uint64(u);
+		return *this;
+	}
+	JsonWriter &Double(double d) {
+		if (m_pretty) m_pretty_writer.Double(d); else m_writer.Double(d);
+		return *this;
+	}
+	JsonWriter &String(const char *str, rapidjson::SizeType length, bool copy = false) {
+		if (m_pretty) m_pretty_writer.String(str, length, copy); else m_writer.String(str, length, copy);
+		return *this;
+	}
+	JsonWriter &String(const std::string &str) {
+		return String(str.data(), str.size());
+	}
+	JsonWriter &String(const char *str) {
+		return String(str, strlen(str));
+	}
+	JsonWriter &StartObject() {
+		if (m_pretty) m_pretty_writer.StartObject(); else m_writer.StartObject();
+		return *this;
+	}
+	JsonWriter &EndObject(rapidjson::SizeType count = 0) {
+		if (m_pretty) m_pretty_writer.EndObject(count); else m_writer.EndObject(count);
+		return *this;
+	}
+	JsonWriter &StartArray() {
+		if (m_pretty) m_pretty_writer.StartArray(); else m_writer.StartArray();
+		return *this;
+	}
+	JsonWriter &EndArray(rapidjson::SizeType count = 0) {
+		if (m_pretty) m_pretty_writer.EndArray(count); else m_writer.EndArray(count);
+		return *this;
+	}
+
+private:
+	string_stream m_stream;
+	rapidjson::Writer<string_stream> m_writer;
+	rapidjson::PrettyWriter<string_stream> m_pretty_writer;
+	bool m_pretty;
+};
+
 class JsonValue : public rapidjson::Value
 {
 public:
@@ -40,14 +138,14 @@ public:
 		obj.AddMember("time-raw", tobj_raw, alloc);
 	}
 
-	std::string ToString() const {
-		rapidjson::StringBuffer buffer;
-		rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+	std::string ToString(bool pretty = false) const {
+		std::string ret;
+		JsonWriter writer(ret, pretty);
 
 		Accept(writer);
-		buffer.Put('\n');
+		ret.push_back('\n');
 
-		return std::string(buffer.GetString(), buffer.Size());
+		return ret;
 	}
 
 	rapidjson::MemoryPoolAllocator<> &GetAllocator() {
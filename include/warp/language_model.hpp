@@ -1,6 +1,17 @@
 #pragma once
 
+#include "warp/completion.hpp"
 #include "warp/fuzzy.hpp"
+#include "warp/utf8.hpp"
+#include "warp/xor_filter.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <unordered_map>
 
 namespace ioremap { namespace warp {
 
@@ -13,10 +24,31 @@ struct language_model {
 	} error;
 
 	std::string lang_model_path;
+
+	// optional prefix completion index built by warp_completion
+	std::string completion_path;
+};
+
+struct completion_result {
+	std::string language;
+	completion::result form;
 };
 
 class language_checker {
 public:
+	typedef detector<std::string, std::string> language_detector;
+
+	// maximum number of texts waiting for the trainer, /add_language fails when queue is full
+	const size_t train_queue_limit = 1024;
+
+	language_checker() : m_det(std::make_shared<language_detector>()) {}
+	language_checker(const language_checker &) = delete;
+	language_checker &operator=(const language_checker &) = delete;
+
+	~language_checker() {
+		stop_trainer();
+	}
+
 	ribosome::error_info load_language_model(const language_model &m) {
 		std::shared_ptr<warp::checker> ch(new warp::checker());
 
@@ -32,17 +64,110 @@ public:
 					m.error.replace_path.c_str(), m.error.around_path.c_str(), err.message().c_str());
 		}
 
+		if (m.completion_path.size()) {
+			std::shared_ptr<completion::index> idx(new completion::index());
+			err = idx->open(m.completion_path);
+			if (err) {
+				return ribosome::create_error(err.code(), "could not load completion index: %s, error: %s",
+						m.completion_path.c_str(), err.message().c_str());
+			}
+
+			m_completions[m.language] = idx;
+		}
+
 		m_checkers.emplace(std::pair<std::string, std::shared_ptr<warp::checker>>(m.language, std::move(ch)));
+		m_known_languages.insert(m.language);
 		return ribosome::error_info();
 	}
 
+	// Returns up to @max_num most frequent words starting with @prefix,
+	// if @lang is empty, completions of all languages are merged by frequency
+	ribosome::error_info complete(const std::string &lang, const std::string &prefix, size_t max_num,
+			std::vector<completion_result> *ret) const {
+		std::vector<completion::result> forms;
+
+		for (const auto &p: m_completions) {
+			if (lang.size() && lang != p.first)
+				continue;
+
+			forms.clear();
+			p.second->complete(prefix.data(), prefix.size(), max_num, &forms);
+
+			for (const auto &f: forms) {
+				completion_result res;
+				res.language = p.first;
+				res.form = f;
+				ret->emplace_back(std::move(res));
+			}
+		}
+
+		if (lang.size() && m_completions.find(lang) == m_completions.end()) {
+			return ribosome::create_error(-ENOENT, "there is no completion index for lang '%s'", lang.c_str());
+		}
+
+		std::stable_sort(ret->begin(), ret->end(), [] (const completion_result &a, const completion_result &b) {
+					return a.form.freq > b.form.freq;
+				});
+		if (ret->size() > max_num)
+			ret->resize(max_num);
+
+		return ribosome::error_info();
+	}
+
+	// Builds in-memory filter which maps every dictionary word to bitmask of languages
+	// containing it, so word language is resolved with one memory probe and one confirming
+	// dictionary read instead of reading every language dictionary in turn.
+	// Must be called after all language models have been loaded.
+	ribosome::error_info build_language_filter() {
+		m_filter.clear();
+
+		if (m_checkers.size() > max_filter_languages)
+			return ribosome::error_info();
+
+		std::vector<std::pair<uint64_t, uint8_t>> keys;
+		uint8_t bit = 1;
+		for (const auto &p: m_checkers) {
+			auto err = p.second->for_each_word([&] (const char *word, size_t size) -> bool {
+						keys.emplace_back(word_filter::hash(word, size), bit);
+						return true;
+					});
+			if (err) {
+				return ribosome::create_error(err.code(), "could not read words of language %s: %s",
+						p.first.c_str(), err.message().c_str());
+			}
+
+			bit <<= 1;
+		}
+
+		return m_filter.build(keys);
+	}
+
 	ribosome::error_info load_langdetect_stats(const std::string &path) {
-		int err = m_det.load_file(path.c_str());
+		std::unique_ptr<language_detector> det(new language_detector());
+		int err = det->load_file(path.c_str());
 		if (err) {
 			return ribosome::create_error(err, "could not load language detector stats from file %s", path.c_str());
 		}
 
+		stop_trainer();
+
 		m_language_stats_path = path;
+		m_known_languages.insert(det->languages().begin(), det->languages().end());
+
+		// compiled model does not have statistics, learning is not possible
+		if (!det->has_stats()) {
+			m_train.reset();
+			publish(std::shared_ptr<const language_detector>(det.release()));
+			return ribosome::error_info();
+		}
+
+		// statistics are owned by the trainer, readers only get profiles
+		publish(std::make_shared<language_detector>(det->profile_copy()));
+
+		m_train = std::move(det);
+		m_train_stop = false;
+		m_trainer = std::thread(std::bind(&language_checker::train, this));
+
 		return ribosome::error_info();
 	}
 
@@ -71,19 +196,196 @@ public:
 		return it->second->check(ctl, ret);
 	}
 
+	// Checks all words at once, @ret contains result for every control in the same order.
+	// Language of every word is resolved with one MultiGet() per language, words which
+	// are not exact dictionary matches are then checked in batches per language,
+	// concurrent checks of the same word share one computation.
+	ribosome::error_info check_batch(const std::vector<check_control> &ctls, std::vector<check_result> *ret) {
+		ret->clear();
+		ret->resize(ctls.size());
+
+		std::vector<size_t> pending;
+		for (size_t i = 0; i < ctls.size(); ++i) {
+			if (ctls[i].word.empty()) {
+				(*ret)[i].err = ribosome::create_error(-ENOENT, "no word has been provided");
+				continue;
+			}
+
+			pending.push_back(i);
+		}
+
+		std::vector<uint8_t> masks(ctls.size(), 0);
+		for (auto idx: pending) {
+			masks[idx] = language_mask(ctls[idx].word);
+		}
+
+		// the first language in which word exists wins, just like language() does,
+		// only words which language filter points to are read from every dictionary
+		std::vector<std::string> words;
+		std::vector<size_t> probe;
+		std::vector<dictionary::word_form> wfs;
+		size_t lang_idx = 0;
+		for (const auto &p: m_checkers) {
+			if (pending.empty())
+				break;
+
+			words.clear();
+			probe.clear();
+			std::vector<size_t> misses;
+			for (auto idx: pending) {
+				if (may_contain(masks[idx], lang_idx)) {
+					words.push_back(ctls[idx].word);
+					probe.push_back(idx);
+				} else {
+					misses.push_back(idx);
+				}
+			}
+			lang_idx++;
+
+			if (words.empty())
+				continue;
+
+			auto err = p.second->lookup(words, &wfs);
+			if (err)
+				return err;
+
+			for (size_t i = 0; i < probe.size(); ++i) {
+				size_t idx = probe[i];
+				if (wfs[i].word.empty()) {
+					misses.push_back(idx);
+					continue;
+				}
+
+				check_result &res = (*ret)[idx];
+				res.language = p.first;
+				res.forms.emplace_back(std::move(wfs[i]));
+			}
+
+			std::sort(misses.begin(), misses.end());
+			pending.swap(misses);
+		}
+
+		std::shared_ptr<const language_detector> det = detector_snapshot();
+		std::map<std::string, std::vector<size_t>> langs;
+		for (auto idx: pending) {
+			std::string lang = det->detect(ctls[idx].word);
+			(*ret)[idx].language = lang;
+			langs[lang].push_back(idx);
+		}
+
+		for (const auto &p: langs) {
+			const auto &lang = p.first;
+			const auto &indexes = p.second;
+
+			auto it = m_checkers.find(lang);
+			if (it == m_checkers.end()) {
+				for (auto idx: indexes) {
+					(*ret)[idx].err = ribosome::create_error(-ENOENT,
+							"there is no language detector for lang '%s', word: '%s'",
+							lang.c_str(), ctls[idx].word.c_str());
+				}
+				continue;
+			}
+
+			std::vector<check_control> lctls;
+			lctls.reserve(indexes.size());
+			for (auto idx: indexes) {
+				lctls.push_back(ctls[idx]);
+			}
+
+			std::vector<check_result> lret;
+			auto err = check_coalesced(lang, *it->second, lctls, &lret);
+			if (err)
+				return err;
+
+			for (size_t i = 0; i < indexes.size(); ++i) {
+				check_result &res = (*ret)[indexes[i]];
+				res.err = lret[i].err;
+				res.forms.swap(lret[i].forms);
+			}
+		}
+
+		return ribosome::error_info();
+	}
+
+	// Queues text for the background trainer, it will be merged into detector statistics
+	// together with other pending texts, persisted and published as a new detector snapshot.
+	// Returns error of the previous failed training round if there was one.
 	ribosome::error_info detector_save(const std::string &text, const std::string &lang) {
-		m_det.load_text(text, lang);
-		m_det.sort();
+		std::unique_lock<std::mutex> guard(m_train_lock);
 
-		int err = m_det.save_file(m_language_stats_path.c_str());
-		if (err) {
-			return ribosome::create_error(err, "could not save language detector stats to file %s",
-					m_language_stats_path.c_str());
+		if (!m_train) {
+			if (m_language_stats_path.empty()) {
+				return ribosome::create_error(-ENOTSUP, "language detector statistics have not been loaded, "
+						"there is nothing to learn into");
+			}
+
+			return ribosome::create_error(-ENOTSUP, "language detector has been loaded from compiled model %s, "
+					"it does not contain statistics needed for learning", m_language_stats_path.c_str());
+		}
+
+		if (m_train_error) {
+			ribosome::error_info err = std::move(m_train_error);
+			m_train_error = ribosome::error_info();
+			return err;
 		}
 
+		if (m_train_queue.size() >= train_queue_limit) {
+			return ribosome::create_error(-EAGAIN, "language detector train queue is full: %zd texts",
+					m_train_queue.size());
+		}
+
+		m_train_queue.emplace_back(text, lang);
+		m_train_wait.notify_one();
+
 		return ribosome::error_info();
 	}
 
+	// document detection stops once the best language leads the second one by this fraction of its score
+	void set_detection_margin(double margin, size_t min_ngrams) {
+		m_detection_margin = margin;
+		m_detection_min_ngrams = min_ngrams;
+	}
+
+	std::string detect_document(const std::string &text) const {
+		return detector_snapshot()->detect_document(text, m_detection_margin, m_detection_min_ngrams);
+	}
+
+	// models are loaded before the server starts, so the set is not locked
+	bool known_language(const std::string &lang) const {
+		return m_known_languages.find(lang) != m_known_languages.end();
+	}
+
+	// Uses language of the document @prior as the first guess, other languages are only checked
+	// when word is not found in the prior language dictionary, unknown words get the prior language.
+	std::string language(const std::string &word, const std::string &prior) {
+		auto it = m_checkers.find(prior);
+		if (it == m_checkers.end())
+			return language(word);
+
+		check_control ctl;
+		ctl.word = word;
+		ctl.level = check_control::level_0;
+
+		uint8_t mask = language_mask(word);
+		size_t prior_idx = std::distance(m_checkers.begin(), it);
+
+		std::vector<dictionary::word_form> tmp;
+		if (may_contain(mask, prior_idx) && !it->second->check(ctl, &tmp))
+			return prior;
+
+		size_t lang_idx = 0;
+		for (const auto &p: m_checkers) {
+			bool probe = may_contain(mask, lang_idx) && p.first != prior;
+			lang_idx++;
+
+			if (probe && !p.second->check(ctl, &tmp))
+				return p.first;
+		}
+
+		return prior;
+	}
+
 	std::string language(const std::string &word) {
 		check_control ctl;
 		ctl.word = word;
@@ -93,7 +395,7 @@ public:
 
 	std::string language(const ribosome::lstring &lw) {
 		check_control ctl;
-		ctl.word = ribosome::lconvert::to_string(lw);
+		ctl.word = warp::utf8::to_string(lw);
 		ctl.lw = lw;
 
 		return language(ctl);
@@ -111,25 +413,301 @@ public:
 private:
 	std::map<std::string, std::shared_ptr<warp::checker>> m_checkers;
 
+	// languages of checkers and of the detector loaded at start, languages learnt later are not included
+	std::set<std::string> m_known_languages;
+	std::map<std::string, std::shared_ptr<completion::index>> m_completions;
+
+	// bit i of the filter value is set when word is in the dictionary of the i-th language in map order
+	static const size_t max_filter_languages = 8;
+	word_filter m_filter;
+
 	std::string m_language_stats_path;
-	detector<std::string, std::string> m_det;
+
+	double m_detection_margin = 0.1;
+	size_t m_detection_min_ngrams = 256;
+
+	// Detector used for detection is an immutable snapshot which is replaced by the trainer.
+	// Readers cache snapshot in thread-local storage and only reload it when generation changes,
+	// so the hot path is a single atomic load.
+	std::shared_ptr<const language_detector> m_det;
+	std::atomic<uint64_t> m_det_generation{0};
+
+	// trainer owns private copy of the detector with full statistics
+	std::unique_ptr<language_detector> m_train;
+	std::thread m_trainer;
+	std::mutex m_train_lock;
+	std::condition_variable m_train_wait;
+	std::deque<std::pair<std::string, std::string>> m_train_queue;
+	ribosome::error_info m_train_error;
+	bool m_train_stop = false;
+
+	// Single-flight checks: the first request which checks given (language, word, level, max_num)
+	// computes it, concurrent requests for the same key wait for its result instead of running
+	// the same fuzzy search. Flight is removed as soon as it completes, results are not cached.
+	struct flight {
+		std::mutex lock;
+		std::condition_variable wait;
+		bool done = false;
+		bool failed = false;
+		check_result result;
+
+		// requests which joined the flight, protected by m_flights_lock
+		size_t waiters = 0;
+	};
+	std::mutex m_flights_lock;
+	std::unordered_map<std::string, std::shared_ptr<flight>> m_flights;
+
+	static std::string flight_key(const std::string &lang, const check_control &ctl) {
+		std::string key = lang;
+		key.push_back('\0');
+		key += std::to_string(ctl.level);
+		key.push_back('.');
+		key += std::to_string(ctl.max_num);
+		key.push_back('\0');
+		key += ctl.word;
+		return key;
+	}
+
+	// Removes flights and hands results to their waiters, flights nobody has joined are just dropped,
+	// so uncontended checks do not copy results. @failed means the batch failed as a whole.
+	void land(const std::vector<std::string> &keys, const std::vector<std::shared_ptr<flight>> &flights,
+			const std::vector<check_result> &results, bool failed) {
+		std::vector<size_t> joined;
+		{
+			std::unique_lock<std::mutex> guard(m_flights_lock);
+			for (size_t i = 0; i < keys.size(); ++i) {
+				m_flights.erase(keys[i]);
+				if (flights[i]->waiters)
+					joined.push_back(i);
+			}
+		}
+
+		for (auto i: joined) {
+			flight &f = *flights[i];
+
+			std::unique_lock<std::mutex> guard(f.lock);
+			if (failed) {
+				f.failed = true;
+			} else {
+				f.result.err = results[i].err;
+				f.result.forms = results[i].forms;
+			}
+			f.done = true;
+			f.wait.notify_all();
+		}
+	}
+
+	ribosome::error_info check_coalesced(const std::string &lang, warp::checker &ch,
+			const std::vector<check_control> &ctls, std::vector<check_result> *ret) {
+		ret->clear();
+		ret->resize(ctls.size());
+
+		// words this call computes and indexes of controls which share each of them,
+		// duplicates inside one batch are resolved locally, since waiting for own flight would never end
+		std::vector<check_control> lead_ctls;
+		std::vector<std::string> lead_keys;
+		std::vector<std::shared_ptr<flight>> lead_flights;
+		std::vector<std::vector<size_t>> lead_indexes;
+		std::unordered_map<std::string, size_t> local;
+
+		std::vector<std::pair<size_t, std::shared_ptr<flight>>> waiters;
+
+		{
+			std::unique_lock<std::mutex> guard(m_flights_lock);
+			for (size_t i = 0; i < ctls.size(); ++i) {
+				std::string key = flight_key(lang, ctls[i]);
+
+				auto lit = local.find(key);
+				if (lit != local.end()) {
+					lead_indexes[lit->second].push_back(i);
+					continue;
+				}
+
+				auto fit = m_flights.find(key);
+				if (fit != m_flights.end()) {
+					fit->second->waiters++;
+					waiters.emplace_back(i, fit->second);
+					continue;
+				}
+
+				auto f = std::make_shared<flight>();
+				m_flights[key] = f;
+				local[key] = lead_ctls.size();
+
+				lead_ctls.push_back(ctls[i]);
+				lead_keys.emplace_back(std::move(key));
+				lead_flights.emplace_back(std::move(f));
+				lead_indexes.emplace_back(1, i);
+			}
+		}
+
+		// own flights are completed before waiting for others, so two requests never wait for each other,
+		// failed flights are completed too, their waiters check the words themselves
+		std::vector<check_result> lret;
+		ribosome::error_info err;
+		try {
+			if (lead_ctls.size()) {
+				err = ch.check_batch(lead_ctls, &lret);
+			}
+		} catch (const std::exception &e) {
+			err = ribosome::create_error(-EINVAL, "could not check words: %s", e.what());
+		}
+		lret.resize(lead_ctls.size());
+
+		land(lead_keys, lead_flights, lret, !!err);
+		if (err)
+			return err;
+
+		for (size_t i = 0; i < lead_indexes.size(); ++i) {
+			const auto &indexes = lead_indexes[i];
+			for (size_t j = 0; j < indexes.size(); ++j) {
+				check_result &res = (*ret)[indexes[j]];
+				res.err = lret[i].err;
+				if (j + 1 == indexes.size())
+					res.forms.swap(lret[i].forms);
+				else
+					res.forms = lret[i].forms;
+			}
+		}
+
+		std::vector<check_control> retry_ctls;
+		std::vector<size_t> retry_indexes;
+		for (auto &w: waiters) {
+			flight &f = *w.second;
+
+			std::unique_lock<std::mutex> guard(f.lock);
+			f.wait.wait(guard, [&f] { return f.done; });
+
+			if (f.failed) {
+				retry_ctls.push_back(ctls[w.first]);
+				retry_indexes.push_back(w.first);
+				continue;
+			}
+
+			(*ret)[w.first].err = f.result.err;
+			(*ret)[w.first].forms = f.result.forms;
+		}
+
+		if (retry_ctls.size()) {
+			std::vector<check_result> rret;
+			try {
+				err = ch.check_batch(retry_ctls, &rret);
+			} catch (const std::exception &e) {
+				err = ribosome::create_error(-EINVAL, "could not check words: %s", e.what());
+			}
+			if (err)
+				return err;
+
+			for (size_t i = 0; i < retry_indexes.size(); ++i) {
+				(*ret)[retry_indexes[i]] = std::move(rret[i]);
+			}
+		}
+
+		return ribosome::error_info();
+	}
+
+	void publish(const std::shared_ptr<const language_detector> &det) {
+		std::atomic_store(&m_det, det);
+		m_det_generation.fetch_add(1);
+	}
+
+	std::shared_ptr<const language_detector> detector_snapshot() const {
+		struct cache {
+			const language_checker *owner = NULL;
+			uint64_t generation = 0;
+			std::shared_ptr<const language_detector> det;
+		};
+		static thread_local cache c;
+
+		uint64_t generation = m_det_generation.load();
+		if (c.owner != this || c.generation != generation) {
+			c.det = std::atomic_load(&m_det);
+			c.owner = this;
+			c.generation = generation;
+		}
+
+		return c.det;
+	}
+
+	void stop_trainer() {
+		if (!m_trainer.joinable())
+			return;
+
+		{
+			std::unique_lock<std::mutex> guard(m_train_lock);
+			m_train_stop = true;
+			m_train_wait.notify_one();
+		}
+
+		m_trainer.join();
+	}
+
+	void train() {
+		while (true) {
+			std::deque<std::pair<std::string, std::string>> batch;
+
+			{
+				std::unique_lock<std::mutex> guard(m_train_lock);
+				m_train_wait.wait(guard, [this] { return m_train_stop || !m_train_queue.empty(); });
+
+				// pending texts are still merged and persisted on shutdown
+				if (m_train_queue.empty())
+					return;
+
+				batch.swap(m_train_queue);
+			}
+
+			for (const auto &p: batch) {
+				m_train->load_text(p.first, p.second);
+			}
+			m_train->sort();
+
+			int err = m_train->save_file(m_language_stats_path.c_str());
+			if (err) {
+				std::unique_lock<std::mutex> guard(m_train_lock);
+				m_train_error = ribosome::create_error(err, "could not save language detector stats to file %s",
+						m_language_stats_path.c_str());
+			}
+
+			// snapshot does not need raw n-gram counts, they are not copied
+			publish(std::make_shared<language_detector>(m_train->profile_copy()));
+		}
+	}
+
+	// bitmask of languages whose dictionaries may contain @word
+	uint8_t language_mask(const std::string &word) const {
+		if (m_filter.empty())
+			return 0;
+
+		return m_filter.find(word);
+	}
+
+	// every language has to be probed when there is no filter
+	bool may_contain(uint8_t mask, size_t lang_idx) const {
+		return m_filter.empty() || (mask & (1U << lang_idx));
+	}
 
 	std::string language(check_control &ctl) {
 		ctl.level = check_control::level_0;
 
 		std::vector<dictionary::word_form> tmp;
 
+		uint8_t mask = language_mask(ctl.word);
+		size_t lang_idx = 0;
 		for (const auto &p: m_checkers) {
 			const auto &ch = p.second;
 			const auto &lang = p.first;
 
+			if (!may_contain(mask, lang_idx++))
+				continue;
+
 			auto err = ch->check(ctl, &tmp);
 			if (!err) {
 				return lang;
 			}
 		}
 
-		return m_det.detect(ctl.word);
+		return detector_snapshot()->detect(ctl.word);
 	}
 };
 
@@ -1,22 +1,67 @@
 #ifndef __FUZZY_LETTER_ERROR_MODEL_HPP
 #define __FUZZY_LETTER_ERROR_MODEL_HPP
 
+#include "warp/utf8.hpp"
+
 #include <ribosome/error.hpp>
 #include <ribosome/lstring.hpp>
 
+#include <algorithm>
 #include <fstream>
 #include <map>
-#include <set>
 #include <string>
+#include <vector>
 
 namespace ioremap { namespace warp { namespace error_model {
 
+// Contiguous range of letters returned by letter_error_model::transform()
+class letter_span {
+public:
+	letter_span(const ribosome::letter *begin, const ribosome::letter *end) : m_begin(begin), m_end(end) {}
+
+	const ribosome::letter *begin() const {
+		return m_begin;
+	}
+	const ribosome::letter *end() const {
+		return m_end;
+	}
+	size_t size() const {
+		return m_end - m_begin;
+	}
+
+private:
+	const ribosome::letter *m_begin, *m_end;
+};
+
 class letter_error_model {
 public:
+	// Noisy channel edit costs, substitution of a letter by one from its replace or around
+	// mapping is cheaper than arbitrary substitution
+	struct costs {
+		float replace = 0.4;
+		float around = 0.6;
+		float substitute = 1;
+		float insert = 1;
+		float remove = 1;
+		float transpose = 0.7;
+	};
+
 	letter_error_model() {}
 	letter_error_model(letter_error_model &&emod) {
 		m_around.swap(emod.m_around);
 		m_replace.swap(emod.m_replace);
+		m_index.swap(emod.m_index);
+		m_entries.swap(emod.m_entries);
+		m_letters.swap(emod.m_letters);
+		m_base = emod.m_base;
+		m_costs = emod.m_costs;
+		m_substitute.swap(emod.m_substitute);
+		m_insert.swap(emod.m_insert);
+		m_remove.swap(emod.m_remove);
+	}
+
+	const struct costs &edit_costs() const {
+		return m_costs;
 	}
 
 	ribosome::error_info load_transform_around(const std::string &path) {
@@ -24,6 +69,8 @@ public:
 		if (m_around.empty()) {
 			return ribosome::create_error(-errno, "could not load around map from file %s", path.c_str());
 		}
+
+		compile();
 		return ribosome::error_info();
 	}
 
@@ -32,33 +79,61 @@ public:
 		if (m_replace.empty()) {
 			return ribosome::create_error(-errno, "could not load replace map from file %s", path.c_str());
 		}
+
+		compile();
 		return ribosome::error_info();
 	}
 
-	ribosome::lstring transform(const ribosome::letter &src, int pos) const {
-		std::set<ribosome::letter> ret;
-		ret.insert(src);
+	// Returns sorted set of letters @src can be mistyped from: @src itself, its replace mapping,
+	// and unless this is the first letter in the word (@pos is 0) its keyboard neighbours.
+	//
+	// Returned span points either into compiled table (and is valid until error model is reloaded),
+	// or to @src itself if there are no mappings for this letter.
+	letter_span transform(const ribosome::letter &src, int pos) const {
+		size_t idx = src.l - m_base;
+		if (src.l >= m_base && idx < m_index.size() && m_index[idx] != 0) {
+			const entry &e = m_entries[m_index[idx] - 1];
+			const ribosome::letter *ptr = m_letters.data();
 
-		auto it = m_replace.find(src);
-		if (it != m_replace.end()) {
-			ret.insert(it->second.begin(), it->second.end());
-		}
-
-		if (pos != 0) {
-			it = m_around.find(src);
-			if (it != m_around.end()) {
-				ret.insert(it->second.begin(), it->second.end());
+			if (pos != 0) {
+				return letter_span(ptr + e.around_offset, ptr + e.around_offset + e.around_size);
 			}
-#if 0
-			std::cout << "transform: " <<
-				"pos: " << pos <<
-				", letter: " << src.str() <<
-				" -> " << ribosome::lconvert::to_string(ribosome::lstring(ret.begin(), ret.end())) <<
-				std::endl;
-#endif
+
+			return letter_span(ptr + e.replace_offset, ptr + e.replace_offset + e.replace_size);
 		}
 
-		return ribosome::lstring(ret.begin(), ret.end());
+		return letter_span(&src, &src + 1);
+	}
+
+	// Per-letter edit costs used by distance::weighted_damerau(), @typed is a letter
+	// found in the checked word, @intended is a letter of dictionary word
+	float substitute(const ribosome::letter &typed, const ribosome::letter &intended) const {
+		int i = position(typed);
+		int j = position(intended);
+		if (i < 0 || j < 0)
+			return m_costs.substitute;
+
+		return m_substitute[i * m_entries.size() + j];
+	}
+
+	float insert(const ribosome::letter &intended) const {
+		int i = position(intended);
+		if (i < 0)
+			return m_costs.insert;
+
+		return m_insert[i];
+	}
+
+	float remove(const ribosome::letter &typed) const {
+		int i = position(typed);
+		if (i < 0)
+			return m_costs.remove;
+
+		return m_remove[i];
+	}
+
+	float transpose(const ribosome::letter &, const ribosome::letter &) const {
+		return m_costs.transpose;
 	}
 
 private:
@@ -66,6 +141,120 @@ private:
 
 	tmap m_around, m_replace;
 
+	// Compiled transform table: @m_index maps (letter - @m_base) to entry number plus one,
+	// every entry references two sorted deduplicated letter ranges in @m_letters,
+	// with and without around mapping
+	struct entry {
+		uint32_t replace_offset;
+		uint32_t replace_size;
+		uint32_t around_offset;
+		uint32_t around_size;
+	};
+
+	std::vector<uint32_t> m_index;
+	std::vector<entry> m_entries;
+	std::vector<ribosome::letter> m_letters;
+	unsigned int m_base = 0;
+
+	// Flat cost tables indexed by letter position in compiled alphabet,
+	// substitution matrix is stored row-wise by typed letter
+	struct costs m_costs;
+	std::vector<float> m_substitute;
+	std::vector<float> m_insert, m_remove;
+
+	int position(const ribosome::letter &l) const {
+		size_t idx = l.l - m_base;
+		if (l.l < m_base || idx >= m_index.size())
+			return -1;
+
+		return (int)m_index[idx] - 1;
+	}
+
+	void compile() {
+		m_index.clear();
+		m_entries.clear();
+		m_letters.clear();
+		m_base = 0;
+		m_substitute.clear();
+		m_insert.clear();
+		m_remove.clear();
+
+		std::vector<ribosome::letter> alphabet;
+		for (const tmap *m: {&m_replace, &m_around}) {
+			for (const auto &p: *m) {
+				alphabet.push_back(p.first);
+				alphabet.insert(alphabet.end(), p.second.begin(), p.second.end());
+			}
+		}
+
+		if (alphabet.empty())
+			return;
+
+		std::sort(alphabet.begin(), alphabet.end());
+		alphabet.erase(std::unique(alphabet.begin(), alphabet.end()), alphabet.end());
+
+		m_base = alphabet.front().l;
+		m_index.resize(alphabet.back().l - m_base + 1, 0);
+
+		auto append = [&] (std::vector<ribosome::letter> &tmp) -> uint32_t {
+			std::sort(tmp.begin(), tmp.end());
+			tmp.erase(std::unique(tmp.begin(), tmp.end()), tmp.end());
+
+			uint32_t offset = m_letters.size();
+			m_letters.insert(m_letters.end(), tmp.begin(), tmp.end());
+			return offset;
+		};
+
+		std::vector<ribosome::letter> tmp;
+		for (const auto &l: alphabet) {
+			entry e;
+
+			tmp.assign(1, l);
+			auto it = m_replace.find(l);
+			if (it != m_replace.end()) {
+				tmp.insert(tmp.end(), it->second.begin(), it->second.end());
+			}
+			e.replace_offset = append(tmp);
+			e.replace_size = tmp.size();
+
+			it = m_around.find(l);
+			if (it != m_around.end()) {
+				tmp.insert(tmp.end(), it->second.begin(), it->second.end());
+			}
+			e.around_offset = append(tmp);
+			e.around_size = tmp.size();
+
+			m_entries.push_back(e);
+			m_index[l.l - m_base] = m_entries.size();
+		}
+
+		size_t num = m_entries.size();
+		m_insert.assign(num, m_costs.insert);
+		m_remove.assign(num, m_costs.remove);
+		m_substitute.assign(num * num, m_costs.substitute);
+
+		auto set_costs = [&] (const tmap &m, float cost) {
+			for (const auto &p: m) {
+				int i = position(p.first);
+				for (const auto &l: p.second) {
+					int j = position(l);
+					if (j < 0)
+						continue;
+
+					float &c = m_substitute[i * num + j];
+					c = std::min(c, cost);
+				}
+			}
+		};
+
+		set_costs(m_around, m_costs.around);
+		set_costs(m_replace, m_costs.replace);
+
+		for (size_t i = 0; i < num; ++i) {
+			m_substitute[i * num + i] = 0;
+		}
+	}
+
 	tmap load_map(const std::string &path) {
 		std::ifstream in(path);
 
@@ -75,7 +264,7 @@ private:
 			size_t pos = line.find(' ');
 			if (pos != std::string::npos) {
 				ribosome::letter f = s2l(line.c_str(), pos);
-				ret[f] = ribosome::lconvert::from_utf8(line.substr(pos + 1));
+				ret[f] = warp::utf8::to_lstring(line.substr(pos + 1));
 			}
 		}
 
@@ -84,7 +273,7 @@ private:
 
 	ribosome::letter s2l(const char *ptr, size_t size)
 	{
-		ribosome::lstring s = ribosome::lconvert::from_utf8(ptr, size);
+		ribosome::lstring s = warp::utf8::to_lstring(ptr, size);
 		return s[0];
 	}
 };
@@ -17,18 +17,18 @@
 #ifndef __WARP_LSTRING_HPP
 #define __WARP_LSTRING_HPP
 
+#include "warp/utf8.hpp"
+
 #include <fstream>
 #include <sstream>
 #include <string>
 
 #include <boost/locale.hpp>
-#include <boost/locale/util.hpp>
 
 namespace ioremap { namespace warp {
 
 static const boost::locale::generator __fuzzy_locale_generator;
 static const std::locale __fuzzy_locale(__fuzzy_locale_generator("en_US.UTF8"));
-static const auto __fuzzy_utf8_converter = boost::locale::util::create_utf8_converter();
 
 template <typename T>
 struct letter {
@@ -41,11 +41,8 @@ struct letter {
 	}
 
 	std::string str() const {
-		char tmp[8];
-		memset(tmp, 0, sizeof(tmp));
-		__fuzzy_utf8_converter->from_unicode(l, tmp, tmp + 8);
-
-		return tmp;
+		char tmp[4];
+		return std::string(tmp, utf8::encode_one(l, tmp));
 	}
 
 	bool operator==(const letter &other) const {
@@ -153,9 +150,7 @@ typedef std::basic_string<letter<unsigned int>, letter_traits<unsigned int>> lst
 
 inline std::ostream &operator <<(std::ostream &out, const lstring &ls)
 {
-	for (auto it = ls.begin(); it != ls.end(); ++it) {
-		out << *it;
-	}
+	out << utf8::to_string(ls);
 	return out;
 }
 
@@ -163,25 +158,7 @@ inline std::ostream &operator <<(std::ostream &out, const lstring &ls)
 class lconvert {
 	public:
 		static lstring from_utf8(const char *text, size_t size) {
-			namespace lb = boost::locale::boundary;
-			std::string::const_iterator begin(text);
-			std::string::const_iterator end(text + size);
-
-			lb::ssegment_index wmap(lb::character, begin, end, __fuzzy_locale);
-			wmap.rule(lb::character_any);
-
-			lstring ret;
-
-			for (auto it = wmap.begin(), e = wmap.end(); it != e; ++it) {
-				std::string str = it->str();
-				const char *ptr = str.c_str();
-				auto code = __fuzzy_utf8_converter->to_unicode(ptr, ptr + str.size());
-
-				letter<unsigned int> l(code);
-				ret.append(&l, 1);
-			}
-
-			return ret;
+			return utf8::decode<lstring>(text, size);
 		}
 
 		static lstring from_utf8(const std::string &text) {
@@ -189,9 +166,7 @@ class lconvert {
 		}
 
 		static std::string to_string(const lstring &l) {
-			std::ostringstream ss;
-			ss << l;
-			return ss.str();
+			return utf8::to_string(l);
 		}
 };
 
@@ -0,0 +1,281 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_MESSAGE_HPP
+#define __WARP_MESSAGE_HPP
+
+#include "warp/json.hpp"
+#include "warp/jsonvalue.hpp"
+
+#include <ribosome/error.hpp>
+
+#include <thevoid/stream.hpp>
+
+#include <msgpack.hpp>
+
+#include <string>
+#include <vector>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Requests and replies are either JSON or msgpack with the same schema.
+ * Request format is selected by Content-Type, reply format by Accept header,
+ * if there is no Accept header reply has the same format as request.
+ */
+static const char msgpack_content_type[] = "application/msgpack";
+static const char json_content_type[] = "text/json";
+
+// streamed replies are newline delimited JSON records or concatenated msgpack objects
+static const char ndjson_content_type[] = "application/x-ndjson";
+
+static inline const char *record_content_type(bool msgpack) {
+	return msgpack ? msgpack_content_type : ndjson_content_type;
+}
+
+static inline bool is_msgpack(const boost::optional<std::string> &header) {
+	return header && (header->find("application/msgpack") != std::string::npos ||
+			header->find("application/x-msgpack") != std::string::npos);
+}
+
+struct request_member {
+	const char	*name;
+	size_t		name_size;
+	const char	*value;
+	size_t		value_size;
+};
+
+/*
+ * Request body {"request": {"name": "text", ...}}, members with non-string values are skipped.
+ * Members reference parsed body and are valid while both this object and request buffer are alive.
+ */
+class request_body {
+public:
+	ribosome::error_info parse(const thevoid::http_request &req, const char *data, size_t size) {
+		return parse(is_msgpack(req.headers().content_type()), data, size);
+	}
+
+	ribosome::error_info parse(bool msgpack, const char *data, size_t size) {
+		m_members.clear();
+
+		m_msgpack = msgpack;
+		if (m_msgpack)
+			return parse_msgpack(data, size);
+
+		return parse_json(data, size);
+	}
+
+	bool msgpack() const {
+		return m_msgpack;
+	}
+
+	const std::vector<request_member> &members() const {
+		return m_members;
+	}
+
+private:
+	bool m_msgpack = false;
+	insitu_document m_json;
+	msgpack::unpacked m_msg;
+	std::vector<request_member> m_members;
+
+	ribosome::error_info parse_json(const char *data, size_t size) {
+		rapidjson::Document &doc = m_json.parse(data, size);
+		if (doc.HasParseError()) {
+			return ribosome::create_error(-EINVAL, "document parsing error: %s, offset: %ld",
+					doc.GetParseError(), (long)doc.GetErrorOffset());
+		}
+
+		const auto &req = warp::get_object(doc, "request");
+		if (!req.IsObject()) {
+			return ribosome::create_error(-ENOENT, "'request' must be object");
+		}
+
+		for (auto it = req.MemberBegin(), end = req.MemberEnd(); it != end; ++it) {
+			if (!it->value.IsString())
+				continue;
+
+			request_member m;
+			m.name = it->name.GetString();
+			m.name_size = it->name.GetStringLength();
+			m.value = it->value.GetString();
+			m.value_size = it->value.GetStringLength();
+			m_members.push_back(m);
+		}
+
+		return ribosome::error_info();
+	}
+
+	/*
+	 * Strings are read from the object directly: msgpack-c 1.0+ has separate STR and BIN types
+	 * and raw_ref only converts BIN, clients like Go vmihailenco/msgpack send STR (str8 for 32-255 bytes).
+	 * Older msgpack-c has the only RAW type for both.
+	 */
+	static bool get_raw(const msgpack::object &o, msgpack::type::raw_ref *raw) {
+#if defined(MSGPACK_VERSION_MAJOR) && MSGPACK_VERSION_MAJOR >= 1
+		if (o.type == msgpack::type::STR) {
+			raw->ptr = o.via.str.ptr;
+			raw->size = o.via.str.size;
+			return true;
+		}
+		if (o.type == msgpack::type::BIN) {
+			raw->ptr = o.via.bin.ptr;
+			raw->size = o.via.bin.size;
+			return true;
+		}
+#else
+		if (o.type == msgpack::type::RAW) {
+			raw->ptr = o.via.raw.ptr;
+			raw->size = o.via.raw.size;
+			return true;
+		}
+#endif
+		return false;
+	}
+
+	ribosome::error_info parse_msgpack(const char *data, size_t size) {
+		try {
+			msgpack::unpack(&m_msg, data, size);
+		} catch (const std::exception &e) {
+			return ribosome::create_error(-EINVAL, "document parsing error: %s", e.what());
+		}
+
+		const msgpack::object &root = m_msg.get();
+		if (root.type == msgpack::type::MAP) {
+			for (uint32_t i = 0; i < root.via.map.size; ++i) {
+				const msgpack::object_kv &kv = root.via.map.ptr[i];
+
+				msgpack::type::raw_ref key;
+				if (!get_raw(kv.key, &key) || key.size != 7 || memcmp(key.ptr, "request", 7))
+					continue;
+				if (kv.val.type != msgpack::type::MAP)
+					break;
+
+				for (uint32_t j = 0; j < kv.val.via.map.size; ++j) {
+					const msgpack::object_kv &member = kv.val.via.map.ptr[j];
+
+					msgpack::type::raw_ref name, value;
+					if (!get_raw(member.key, &name) || !get_raw(member.val, &value))
+						continue;
+
+					request_member m;
+					m.name = name.ptr;
+					m.name_size = name.size;
+					m.value = value.ptr;
+					m.value_size = value.size;
+					m_members.push_back(m);
+				}
+
+				return ribosome::error_info();
+			}
+		}
+
+		return ribosome::create_error(-ENOENT, "'request' must be object");
+	}
+};
+
+/*
+ * Streams reply either as JSON (compact or pretty) or as msgpack.
+ *
+ * Msgpack needs container sizes up front, so they are passed to StartObject() and StartArray(),
+ * JSON output ignores them. Object size is the number of key-value pairs.
+ */
+class reply_writer {
+public:
+	reply_writer(std::string &out, bool msgpack, bool pretty = false) :
+		m_msgpack(msgpack), m_out(out), m_json(out, pretty), m_stream(out), m_packer(m_stream) {
+	}
+
+	// Accept header wins, otherwise reply has the same format as the request
+	static bool want_msgpack(const thevoid::http_request &req, bool request_msgpack) {
+		auto accept = req.headers().get("Accept");
+		if (accept && accept->find("*/*") == std::string::npos)
+			return is_msgpack(accept);
+
+		return request_msgpack || is_msgpack(accept);
+	}
+
+	const char *content_type() const {
+		return m_msgpack ? msgpack_content_type : json_content_type;
+	}
+
+	reply_writer &StartObject(size_t num) {
+		if (m_msgpack) m_packer.pack_map(num); else m_json.StartObject();
+		return *this;
+	}
+	reply_writer &EndObject() {
+		if (!m_msgpack) m_json.EndObject();
+		return *this;
+	}
+	reply_writer &StartArray(size_t num) {
+		if (m_msgpack) m_packer.pack_array(num); else m_json.StartArray();
+		return *this;
+	}
+	reply_writer &EndArray() {
+		if (!m_msgpack) m_json.EndArray();
+		return *this;
+	}
+	// strings are msgpack STR like clients send them, raw_ref is packed as BIN by msgpack-c 1.0+
+	reply_writer &String(const char *str, size_t size) {
+		if (!m_msgpack) {
+			m_json.String(str, size);
+			return *this;
+		}
+
+#if defined(MSGPACK_VERSION_MAJOR) && MSGPACK_VERSION_MAJOR >= 1
+		m_packer.pack_str(size);
+		m_packer.pack_str_body(str, size);
+#else
+		m_packer.pack(msgpack::type::raw_ref(str, size));
+#endif
+		return *this;
+	}
+	reply_writer &String(const std::string &str) {
+		return String(str.data(), str.size());
+	}
+	reply_writer &String(const char *str) {
+		return String(str, strlen(str));
+	}
+	reply_writer &Int(int i) {
+		if (m_msgpack) m_packer.pack(i); else m_json.Int(i);
+		return *this;
+	}
+	reply_writer &Uint64(uint64_t u) {
+		if (m_msgpack) m_packer.pack(u); else m_json.Uint64(u);
+		return *this;
+	}
+	reply_writer &Double(double d) {
+		if (m_msgpack) m_packer.pack(d); else m_json.Double(d);
+		return *this;
+	}
+
+	// JSON replies end with new line
+	void finish() {
+		if (!m_msgpack)
+			m_out.push_back('\n');
+	}
+
+private:
+	bool m_msgpack;
+	std::string &m_out;
+	JsonWriter m_json;
+	string_stream m_stream;
+	msgpack::packer<string_stream> m_packer;
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_MESSAGE_HPP */
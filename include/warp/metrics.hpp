@@ -0,0 +1,348 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_METRICS_HPP
+#define __WARP_METRICS_HPP
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Log-linear latency histogram in microseconds: values below 16 have their own buckets,
+ * every next power of two is split into 8 buckets, so relative error is at most 12.5%.
+ */
+class histogram {
+public:
+	enum {
+		linear = 16,
+		sub_buckets = 8,
+		max_exponent = 40,
+		size = linear + (max_exponent - 4 + 1) * sub_buckets,
+	};
+
+	histogram() : m_buckets(size, 0) {
+	}
+
+	void add(uint64_t value) {
+		m_buckets[index(value)]++;
+		m_count++;
+		m_sum += value;
+	}
+
+	void merge(const histogram &other) {
+		for (size_t i = 0; i < m_buckets.size(); ++i) {
+			m_buckets[i] += other.m_buckets[i];
+		}
+		m_count += other.m_count;
+		m_sum += other.m_sum;
+	}
+
+	uint64_t count() const {
+		return m_count;
+	}
+	uint64_t sum() const {
+		return m_sum;
+	}
+
+	// number of values which are not greater than @value, @value is rounded down to the bucket boundary
+	uint64_t count_below(uint64_t value) const {
+		uint64_t ret = 0;
+		for (size_t i = 0; i < m_buckets.size() && upper(i) <= value; ++i) {
+			ret += m_buckets[i];
+		}
+		return ret;
+	}
+
+	// upper boundary of the bucket which holds @q quantile
+	uint64_t quantile(double q) const {
+		uint64_t rank = q * m_count;
+		uint64_t seen = 0;
+
+		for (size_t i = 0; i < m_buckets.size(); ++i) {
+			seen += m_buckets[i];
+			if (seen > rank)
+				return upper(i);
+		}
+
+		return 0;
+	}
+
+	static size_t index(uint64_t value) {
+		if (value < linear)
+			return value;
+
+		int exp = 63 - __builtin_clzll(value);
+		if (exp > max_exponent)
+			return size - 1;
+
+		return linear + (exp - 4) * sub_buckets + ((value >> (exp - 3)) & (sub_buckets - 1));
+	}
+
+	// smallest value which does not fit into bucket @idx
+	static uint64_t upper(size_t idx) {
+		if (idx < linear)
+			return idx + 1;
+
+		idx -= linear;
+		int exp = idx / sub_buckets + 4;
+		uint64_t sub = idx % sub_buckets;
+		return (1ULL << exp) + ((sub + 1) << (exp - 3));
+	}
+
+private:
+	std::vector<uint64_t> m_buckets;
+	uint64_t m_count = 0;
+	uint64_t m_sum = 0;
+};
+
+// what is known about single request when its reply is sent
+struct request_stats {
+	std::string	endpoint;
+	std::string	language;
+	int		level = -1;
+
+	uint64_t	duration_us = 0;
+	uint64_t	bytes_in = 0;
+	uint64_t	bytes_out = 0;
+	uint64_t	tokens = 0;
+	bool		error = false;
+};
+
+/*
+ * Request counters and latency histograms broken down by endpoint, language and check level.
+ *
+ * Every thread updates its own shard, its lock is only contended while metrics are scraped,
+ * shards are merged into Prometheus text exposition format on scrape.
+ */
+class metrics {
+public:
+	void record(const request_stats &st) {
+		shard &sh = local();
+
+		std::string key = st.endpoint;
+		key.push_back('\0');
+		key += st.language;
+		key.push_back('\0');
+		key += std::to_string(st.level);
+
+		std::lock_guard<std::mutex> guard(sh.lock);
+		auto it = sh.all.find(key);
+		if (it == sh.all.end()) {
+			series s;
+			s.endpoint = st.endpoint;
+			s.language = st.language;
+			s.level = st.level;
+			it = sh.all.insert(std::make_pair(key, s)).first;
+		}
+
+		series &s = it->second;
+		s.requests++;
+		s.errors += st.error;
+		s.bytes_in += st.bytes_in;
+		s.bytes_out += st.bytes_out;
+		s.tokens += st.tokens;
+		s.latency.add(st.duration_us);
+	}
+
+	std::string prometheus() const {
+		std::map<std::string, series> all;
+
+		{
+			std::lock_guard<std::mutex> guard(m_lock);
+			for (const auto &sh: m_shards) {
+				std::lock_guard<std::mutex> shard_guard(sh->lock);
+				for (const auto &p: sh->all) {
+					auto it = all.find(p.first);
+					if (it == all.end())
+						all.insert(p);
+					else
+						it->second.merge(p.second);
+				}
+			}
+		}
+
+		std::string out;
+		counter(out, all, "warp_requests_total", "Number of processed requests.", &series::requests);
+		counter(out, all, "warp_errors_total", "Number of requests which ended with error reply.", &series::errors);
+		counter(out, all, "warp_request_bytes_total", "Request body bytes received.", &series::bytes_in);
+		counter(out, all, "warp_reply_bytes_total", "Reply body bytes sent.", &series::bytes_out);
+		counter(out, all, "warp_tokens_total", "Number of words tokenized or checked.", &series::tokens);
+
+		static const double bounds[] = {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+			0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+
+		out += "# HELP warp_request_duration_seconds Request processing time.\n";
+		out += "# TYPE warp_request_duration_seconds histogram\n";
+		for (const auto &p: all) {
+			const series &s = p.second;
+
+			for (double b: bounds) {
+				char le[32];
+				snprintf(le, sizeof(le), "%g", b);
+				line(out, "warp_request_duration_seconds_bucket", s, "le", le,
+						s.latency.count_below(b * 1000000));
+			}
+			line(out, "warp_request_duration_seconds_bucket", s, "le", "+Inf", s.latency.count());
+			line(out, "warp_request_duration_seconds_sum", s, s.latency.sum() / 1000000.);
+			line(out, "warp_request_duration_seconds_count", s, s.latency.count());
+		}
+
+		// percentiles use full histogram resolution instead of bucket boundaries above
+		static const char *quantiles[] = {"0.5", "0.9", "0.99", "0.999"};
+
+		out += "# HELP warp_request_latency_seconds Request processing time percentiles since start.\n";
+		out += "# TYPE warp_request_latency_seconds summary\n";
+		for (const auto &p: all) {
+			const series &s = p.second;
+
+			for (const char *q: quantiles) {
+				line(out, "warp_request_latency_seconds", s, "quantile", q,
+						s.latency.quantile(atof(q)) / 1000000.);
+			}
+			line(out, "warp_request_latency_seconds_sum", s, s.latency.sum() / 1000000.);
+			line(out, "warp_request_latency_seconds_count", s, s.latency.count());
+		}
+
+		return out;
+	}
+
+private:
+	struct series {
+		std::string	endpoint;
+		std::string	language;
+		int		level;
+
+		uint64_t	requests = 0;
+		uint64_t	errors = 0;
+		uint64_t	bytes_in = 0;
+		uint64_t	bytes_out = 0;
+		uint64_t	tokens = 0;
+		histogram	latency;
+
+		void merge(const series &other) {
+			requests += other.requests;
+			errors += other.errors;
+			bytes_in += other.bytes_in;
+			bytes_out += other.bytes_out;
+			tokens += other.tokens;
+			latency.merge(other.latency);
+		}
+	};
+
+	struct shard {
+		std::mutex lock;
+		std::map<std::string, series> all;
+	};
+
+	mutable std::mutex m_lock;
+	std::vector<std::unique_ptr<shard>> m_shards;
+
+	// shard of the current thread, it is created on the first request handled by the thread
+	shard &local() {
+		static thread_local metrics *owner = NULL;
+		static thread_local shard *sh = NULL;
+
+		if (owner != this) {
+			std::lock_guard<std::mutex> guard(m_lock);
+			m_shards.emplace_back(new shard);
+
+			sh = m_shards.back().get();
+			owner = this;
+		}
+
+		return *sh;
+	}
+
+	// label value escaping of Prometheus text format
+	static void escape(std::string &out, const std::string &value) {
+		for (char c: value) {
+			if (c == '\\' || c == '"') {
+				out.push_back('\\');
+				out.push_back(c);
+			} else if (c == '\n') {
+				out += "\\n";
+			} else {
+				out.push_back(c);
+			}
+		}
+	}
+
+	static void labels(std::string &out, const series &s, const char *extra_name, const char *extra_value) {
+		out += "{endpoint=\"";
+		escape(out, s.endpoint);
+		out += "\"";
+		if (s.language.size()) {
+			out += ",language=\"";
+			escape(out, s.language);
+			out += "\"";
+		}
+		if (s.level >= 0) {
+			out += ",level=\"";
+			out += std::to_string(s.level);
+			out += "\"";
+		}
+		if (extra_name) {
+			out += ",";
+			out += extra_name;
+			out += "=\"";
+			escape(out, extra_value);
+			out += "\"";
+		}
+		out += "}";
+	}
+
+	template <typename T>
+	static void line(std::string &out, const char *name, const series &s, const char *extra_name,
+			const char *extra_value, T value) {
+		out += name;
+		labels(out, s, extra_name, extra_value);
+
+		char tmp[64];
+		snprintf(tmp, sizeof(tmp), " %.9g\n", (double)value);
+		out += tmp;
+	}
+
+	template <typename T>
+	static void line(std::string &out, const char *name, const series &s, T value) {
+		line(out, name, s, NULL, NULL, value);
+	}
+
+	static void counter(std::string &out, const std::map<std::string, series> &all, const char *name,
+			const char *help, uint64_t series::*field) {
+		out += "# HELP ";
+		out += name;
+		out += " ";
+		out += help;
+		out += "\n# TYPE ";
+		out += name;
+		out += " counter\n";
+
+		for (const auto &p: all) {
+			line(out, name, p.second, p.second.*field);
+		}
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_METRICS_HPP */
@@ -18,15 +18,174 @@
 #define __WARP_NGRAM_HPP
 
 #include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <sstream>
 #include <vector>
 
 #include <msgpack.hpp>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <ribosome/lstring.hpp>
+
 namespace ioremap { namespace warp {
+
+/*
+ * N-gram is packed into 64-bit code, every symbol takes @bits bits, the newest symbol is the lowest one.
+ * N-grams which do not fit into 63 bits are not packed.
+ */
+template <typename T>
+struct ngram_unit;
+
+template <>
+struct ngram_unit<char> {
+	static const int bits = 8;
+	static uint64_t code(char c) {
+		return (unsigned char)c;
+	}
+};
+
+template <>
+struct ngram_unit<ribosome::letter> {
+	static const int bits = 21;
+	static uint64_t code(const ribosome::letter &l) {
+		return l.l & ((1U << bits) - 1);
+	}
+};
+
+template <typename S>
+struct ngram_code {
+	typedef ngram_unit<typename S::value_type> unit;
+
+	static bool packable(size_t n) {
+		return n * unit::bits < 64;
+	}
+
+	static uint64_t mask(size_t n) {
+		return (1ULL << (n * unit::bits)) - 1;
+	}
+
+	static uint64_t pack(const typename S::value_type *ptr, size_t n) {
+		uint64_t code = 0;
+		for (size_t i = 0; i < n; ++i) {
+			code = (code << unit::bits) | unit::code(ptr[i]);
+		}
+		return code;
+	}
+
+	// calls @func(code) for every n-gram of @text without creating substrings
+	template <typename Func>
+	static void for_each(const S &text, size_t n, Func func) {
+		const uint64_t m = mask(n);
+		uint64_t code = 0;
+
+		for (size_t i = 0; i < text.size(); ++i) {
+			code = ((code << unit::bits) | unit::code(text[i])) & m;
+			if (i + 1 >= n)
+				func(code);
+		}
+	}
+};
+
+/*
+ * Open-addressing hash table from packed n-gram code to its rank,
+ * ~0ULL is never a valid code and marks an empty cell.
+ */
+class ngram_table {
+public:
+	static const uint64_t empty_key = ~0ULL;
+
+	void clear() {
+		m_keys.clear();
+		m_values.clear();
+		m_mask = 0;
+		m_size = 0;
+	}
+
+	void reserve(size_t num) {
+		size_t cap = 16;
+		while (cap < num * 2)
+			cap <<= 1;
+
+		std::vector<uint64_t> keys;
+		std::vector<uint32_t> values;
+		keys.swap(m_keys);
+		values.swap(m_values);
+
+		m_keys.assign(cap, uint64_t(empty_key));
+		m_values.assign(cap, 0);
+		m_mask = cap - 1;
+		m_size = 0;
+
+		for (size_t i = 0; i < keys.size(); ++i) {
+			if (keys[i] != empty_key)
+				insert(keys[i], values[i]);
+		}
+	}
+
+	void insert(uint64_t key, uint32_t value) {
+		if ((m_size + 1) * 2 > m_keys.size())
+			reserve(m_size + 1);
+
+		size_t pos = slot(key);
+		while (m_keys[pos] != empty_key) {
+			if (m_keys[pos] == key) {
+				m_values[pos] = value;
+				return;
+			}
+
+			pos = (pos + 1) & m_mask;
+		}
+
+		m_keys[pos] = key;
+		m_values[pos] = value;
+		m_size++;
+	}
+
+	static size_t hash(uint64_t key) {
+		return key * 0x9e3779b97f4a7c15ULL >> 32;
+	}
+
+	uint32_t find(uint64_t key, uint32_t def) const {
+		if (!m_size)
+			return def;
+
+		size_t pos = slot(key);
+		while (m_keys[pos] != empty_key) {
+			if (m_keys[pos] == key)
+				return m_values[pos];
+
+			pos = (pos + 1) & m_mask;
+		}
+
+		return def;
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+private:
+	std::vector<uint64_t> m_keys;
+	std::vector<uint32_t> m_values;
+	size_t m_mask = 0;
+	size_t m_size = 0;
+
+	size_t slot(uint64_t key) const {
+		return hash(key) & m_mask;
+	}
+};
+
 template <typename S>
 class ngram {
 public:
@@ -65,6 +224,21 @@ public:
 		m_map.clear();
 	}
 
+	// copy of the profile without raw n-gram counters
+	ngram profile_copy() const {
+		ngram ret(m_n);
+		ret.m_profile = m_profile;
+		ret.m_table = m_table;
+		return ret;
+	}
+
+	// adds n-gram counters of @other, profile has to be sorted again afterwards
+	void merge(const ngram &other) {
+		for (const auto &p: other.m_map) {
+			m_map[p.first] += p.second;
+		}
+	}
+
 	void sort() {
 		typedef std::pair<S, size_t> sp;
 		std::vector<sp> tmp(m_map.begin(), m_map.end());
@@ -81,9 +255,34 @@ public:
 			if (pos == profile_limit)
 				break;
 		}
+
+		compile();
+	}
+
+	// builds hashed profile used for scoring, must be called after profile has been loaded or sorted
+	void compile() {
+		m_table.clear();
+		if (!ngram_code<S>::packable(m_n))
+			return;
+
+		m_table.reserve(m_profile.size());
+		for (const auto &p: m_profile) {
+			if (p.first.size() != (size_t)m_n)
+				continue;
+
+			m_table.insert(ngram_code<S>::pack(p.first.data(), m_n), p.second);
+		}
 	}
 
 	size_t score(const S &text) const {
+		if (ngram_code<S>::packable(m_n)) {
+			size_t score = 0;
+			ngram_code<S>::for_each(text, m_n, [&] (uint64_t code) {
+						score += m_table.find(code, profile_limit);
+					});
+			return score;
+		}
+
 		size_t score = 0;
 
 		for (ssize_t i = 0; i < (ssize_t)text.size() - (ssize_t)m_n + 1; ++i) {
@@ -107,12 +306,17 @@ public:
 		return m_n;
 	}
 
+	const std::map<S, size_t> &profile() const {
+		return m_profile;
+	}
+
 	MSGPACK_DEFINE(m_n, m_map, m_profile);
 
 private:
 	int m_n = 0;
 	std::map<S, size_t> m_map;
 	std::map<S, size_t> m_profile;
+	ngram_table m_table;
 };
 
 template <typename S>
@@ -131,18 +335,43 @@ public:
 		}
 	}
 
+	probability profile_copy() const {
+		probability ret;
+		for (const auto &ng: m_ngrams) {
+			ret.m_ngrams.emplace(std::pair<size_t, ngram<S>>(ng.first, ng.second.profile_copy()));
+		}
+		return ret;
+	}
+
 	void load_text(const S &text) {
 		for (auto &ng: m_ngrams) {
 			ng.second.load(text);
 		}
 	}
 
+	void merge(const probability &other) {
+		for (const auto &ng: other.m_ngrams) {
+			auto it = m_ngrams.find(ng.first);
+			if (it == m_ngrams.end()) {
+				m_ngrams.insert(ng);
+			} else {
+				it->second.merge(ng.second);
+			}
+		}
+	}
+
 	void sort() {
 		for (auto &ng: m_ngrams) {
 			ng.second.sort();
 		}
 	}
 
+	void compile() {
+		for (auto &ng: m_ngrams) {
+			ng.second.compile();
+		}
+	}
+
 	size_t score(const S &text) const {
 		size_t score = 0;
 
@@ -153,12 +382,514 @@ public:
 		return score;
 	}
 
+	const std::map<size_t, ngram<S>> &ngrams() const {
+		return m_ngrams;
+	}
+
 	MSGPACK_DEFINE(m_ngrams);
 
 private:
 	std::map<size_t, ngram<S>> m_ngrams;
 };
 
+/*
+ * Fused multi-language index: for every n-gram length there is one hash table
+ * from packed n-gram code to a row of per-language ranks, so text is scanned
+ * once and scores of all languages are accumulated together.
+ * Language which has no profile for given length gets zero default rank
+ * for that length, which matches probability::score().
+ *
+ * Index can be written into a compiled model file and used through mmap() as is,
+ * all arrays are 8-byte aligned:
+ *    model_header
+ *    uint32_t name_offsets[num_languages + 1], char names[]
+ *    for every level: level_header, keys[num_slots], rows[num_slots],
+ *        ranks[num_rows * num_languages], defaults[num_languages]
+ */
+struct model_header {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	num_languages;
+	uint32_t	num_levels;
+	uint32_t	reserved;
+	uint64_t	size;
+};
+
+struct model_level_header {
+	uint32_t	n;
+	uint32_t	num_rows;
+	uint64_t	num_slots;
+};
+
+static const char model_magic[8] = "warpdet";
+static const uint32_t model_version = 1;
+
+template <typename S>
+class fused_index {
+public:
+	struct level {
+		uint32_t	n;
+		uint32_t	num_rows;
+		size_t		mask;
+		const uint64_t	*keys;		// mask + 1 slots, ngram_table::empty_key marks empty slot
+		const uint32_t	*rows;		// mask + 1 slots, row index of the key
+		const uint16_t	*ranks;		// rows * num_languages
+		const uint16_t	*defaults;	// num_languages, rank of the n-gram missing in profile
+	};
+
+	void clear() {
+		m_levels.clear();
+		m_storage.reset();
+		m_num_languages = 0;
+	}
+
+	bool empty() const {
+		return m_num_languages == 0;
+	}
+
+	size_t num_languages() const {
+		return m_num_languages;
+	}
+
+	// returns false if profiles can not be fused (too long n-grams or ranks), index is cleared then
+	bool build(const std::vector<const probability<S> *> &probs, size_t profile_limit) {
+		clear();
+
+		if (probs.empty() || profile_limit > 0xffff)
+			return false;
+
+		const size_t num = probs.size();
+
+		std::set<size_t> lengths;
+		for (auto p: probs) {
+			for (const auto &ng: p->ngrams()) {
+				if (!ngram_code<S>::packable(ng.first))
+					return false;
+
+				lengths.insert(ng.first);
+			}
+		}
+
+		std::shared_ptr<storage> st = std::make_shared<storage>();
+		st->levels.resize(lengths.size());
+
+		size_t level_idx = 0;
+		for (size_t n: lengths) {
+			level_storage &ls = st->levels[level_idx++];
+			ls.n = n;
+			ls.defaults.assign(num, 0);
+
+			std::map<uint64_t, uint32_t> rows;
+			for (size_t l = 0; l < num; ++l) {
+				auto it = probs[l]->ngrams().find(n);
+				if (it == probs[l]->ngrams().end())
+					continue;
+
+				ls.defaults[l] = profile_limit;
+				for (const auto &p: it->second.profile()) {
+					if (p.first.size() != n || p.second > 0xffff)
+						return false;
+
+					rows.insert(std::make_pair(ngram_code<S>::pack(p.first.data(), n), rows.size()));
+				}
+			}
+
+			ls.ranks.resize(rows.size() * num);
+			for (size_t r = 0; r < rows.size(); ++r) {
+				std::copy(ls.defaults.begin(), ls.defaults.end(), ls.ranks.begin() + r * num);
+			}
+
+			for (size_t l = 0; l < num; ++l) {
+				auto it = probs[l]->ngrams().find(n);
+				if (it == probs[l]->ngrams().end())
+					continue;
+
+				for (const auto &p: it->second.profile()) {
+					uint32_t row = rows[ngram_code<S>::pack(p.first.data(), n)];
+					ls.ranks[row * num + l] = p.second;
+				}
+			}
+
+			size_t cap = 16;
+			while (cap < rows.size() * 2)
+				cap <<= 1;
+
+			ls.mask = cap - 1;
+			ls.keys.assign(cap, uint64_t(ngram_table::empty_key));
+			ls.rows.assign(cap, 0);
+			for (const auto &r: rows) {
+				size_t pos = ngram_table::hash(r.first) & ls.mask;
+				while (ls.keys[pos] != ngram_table::empty_key)
+					pos = (pos + 1) & ls.mask;
+
+				ls.keys[pos] = r.first;
+				ls.rows[pos] = r.second;
+			}
+		}
+
+		std::vector<level> levels;
+		for (const auto &ls: st->levels) {
+			level lv;
+			lv.n = ls.n;
+			lv.num_rows = ls.ranks.size() / num;
+			lv.mask = ls.mask;
+			lv.keys = ls.keys.data();
+			lv.rows = ls.rows.data();
+			lv.ranks = ls.ranks.data();
+			lv.defaults = ls.defaults.data();
+			levels.push_back(lv);
+		}
+
+		m_levels.swap(levels);
+		m_storage = st;
+		m_num_languages = num;
+		return true;
+	}
+
+	static bool is_compiled(const char *path) {
+		char magic[sizeof(model_magic)];
+		std::ifstream in(path, std::ios::binary);
+		in.read(magic, sizeof(magic));
+		return in.good() && memcmp(magic, model_magic, sizeof(magic)) == 0;
+	}
+
+	// writes index and language names into temporary file which is renamed to @path
+	int write(const char *path, const std::vector<std::string> &names) const {
+		if (names.size() != m_num_languages)
+			return -EINVAL;
+
+		std::string data;
+
+		model_header h;
+		memset(&h, 0, sizeof(model_header));
+		memcpy(h.magic, model_magic, sizeof(h.magic));
+		h.version = model_version;
+		h.num_languages = m_num_languages;
+		h.num_levels = m_levels.size();
+		append(&data, &h, sizeof(model_header));
+
+		uint32_t offset = 0;
+		for (const auto &name: names) {
+			append(&data, &offset, sizeof(uint32_t));
+			offset += name.size();
+		}
+		append(&data, &offset, sizeof(uint32_t));
+		for (const auto &name: names) {
+			append(&data, name.data(), name.size());
+		}
+		align(&data);
+
+		for (const auto &lv: m_levels) {
+			model_level_header lh;
+			lh.n = lv.n;
+			lh.num_rows = lv.num_rows;
+			lh.num_slots = lv.mask + 1;
+			append(&data, &lh, sizeof(model_level_header));
+
+			append(&data, lv.keys, lh.num_slots * sizeof(uint64_t));
+			append(&data, lv.rows, lh.num_slots * sizeof(uint32_t));
+			align(&data);
+			append(&data, lv.ranks, (size_t)lh.num_rows * m_num_languages * sizeof(uint16_t));
+			append(&data, lv.defaults, m_num_languages * sizeof(uint16_t));
+			align(&data);
+		}
+
+		((model_header *)&data[0])->size = data.size();
+
+		std::string tmp_path = std::string(path) + ".tmp";
+		std::ofstream out(tmp_path.c_str(), std::ios::trunc | std::ios::binary);
+		out.write(data.data(), data.size());
+		out.close();
+		if (!out.good())
+			return -EIO;
+
+		if (rename(tmp_path.c_str(), path) != 0)
+			return -errno;
+
+		return 0;
+	}
+
+	// maps compiled model, its pages are shared between all processes which use the same file
+	int open(const char *path, std::vector<std::string> *names) {
+		clear();
+
+		int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			return -errno;
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			int err = -errno;
+			::close(fd);
+			return err;
+		}
+
+		size_t size = st.st_size;
+		if (size < sizeof(model_header)) {
+			::close(fd);
+			return -EINVAL;
+		}
+
+		void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (data == MAP_FAILED)
+			return -errno;
+
+		std::shared_ptr<const void> mapping(data, [size] (const void *ptr) {
+					munmap(const_cast<void *>(ptr), size);
+				});
+
+		// file is untrusted: every length is checked against the bytes left before it is read or skipped,
+		// @ptr never moves past @end, so end - ptr is always the number of bytes left
+		const char *base = (const char *)data;
+		const char *ptr = base;
+		const char *end = ptr + size;
+
+		const model_header *h = (const model_header *)ptr;
+		if (memcmp(h->magic, model_magic, sizeof(model_magic)) || h->version != model_version || h->size != size)
+			return -EINVAL;
+		ptr += sizeof(model_header);
+
+		const size_t num = h->num_languages;
+		if (num == 0 || num >= (size_t)(end - ptr) / sizeof(uint32_t))
+			return -EINVAL;
+
+		const uint32_t *offsets = (const uint32_t *)ptr;
+		ptr += (num + 1) * sizeof(uint32_t);
+		if (offsets[num] > (size_t)(end - ptr))
+			return -EINVAL;
+
+		std::vector<std::string> tmp_names;
+		for (size_t l = 0; l < num; ++l) {
+			if (offsets[l] > offsets[l + 1])
+				return -EINVAL;
+			tmp_names.emplace_back(ptr + offsets[l], offsets[l + 1] - offsets[l]);
+		}
+		ptr += offsets[num];
+		if (!skip_padding(&ptr, base, end))
+			return -EINVAL;
+
+		// every level takes at least its header
+		if (h->num_levels > (size_t)(end - ptr) / sizeof(model_level_header))
+			return -EINVAL;
+
+		std::vector<level> levels;
+		for (uint32_t i = 0; i < h->num_levels; ++i) {
+			if ((size_t)(end - ptr) < sizeof(model_level_header))
+				return -EINVAL;
+			const model_level_header *lh = (const model_level_header *)ptr;
+			ptr += sizeof(model_level_header);
+
+			// slot number is a power of two, which is required by the probe mask
+			if (lh->num_slots == 0 || (lh->num_slots & (lh->num_slots - 1)))
+				return -EINVAL;
+			if (lh->num_slots > (size_t)(end - ptr) / (sizeof(uint64_t) + sizeof(uint32_t)))
+				return -EINVAL;
+
+			level lv;
+			lv.n = lh->n;
+			lv.num_rows = lh->num_rows;
+			lv.mask = lh->num_slots - 1;
+			lv.keys = (const uint64_t *)ptr;
+			ptr += lh->num_slots * sizeof(uint64_t);
+			lv.rows = (const uint32_t *)ptr;
+			ptr += lh->num_slots * sizeof(uint32_t);
+			if (!skip_padding(&ptr, base, end))
+				return -EINVAL;
+
+			// num is not zero and both factors are bounded by the bytes left, so the product does not overflow
+			if (lh->num_rows > (size_t)(end - ptr) / sizeof(uint16_t) / num)
+				return -EINVAL;
+			size_t ranks_size = (size_t)lh->num_rows * num * sizeof(uint16_t);
+			if ((size_t)(end - ptr) - ranks_size < num * sizeof(uint16_t))
+				return -EINVAL;
+
+			lv.ranks = (const uint16_t *)ptr;
+			ptr += ranks_size;
+			lv.defaults = (const uint16_t *)ptr;
+			ptr += num * sizeof(uint16_t);
+			if (!skip_padding(&ptr, base, end))
+				return -EINVAL;
+
+			if (!ngram_code<S>::packable(lv.n) || lv.n == 0)
+				return -EINVAL;
+
+			for (size_t slot = 0; slot <= lv.mask; ++slot) {
+				if (lv.keys[slot] != ngram_table::empty_key && lv.rows[slot] >= lv.num_rows)
+					return -EINVAL;
+			}
+
+			levels.push_back(lv);
+		}
+
+		m_levels.swap(levels);
+		m_storage = mapping;
+		m_num_languages = num;
+		names->swap(tmp_names);
+		return 0;
+	}
+
+	// returns index of the language with the smallest score, the first one wins on ties
+	size_t best(const S &text) const {
+		const size_t num = m_num_languages;
+
+		static thread_local std::vector<size_t> scratch;
+		scratch.assign(num * 2, 0);
+		size_t *total = scratch.data();
+		size_t *part = total + num;
+
+		for (const auto &lv: m_levels) {
+			std::fill(part, part + num, 0);
+			size_t misses = 0;
+
+			ngram_code<S>::for_each(text, lv.n, [&] (uint64_t code) {
+						if (!add_ranks(lv, code, part))
+							misses++;
+					});
+
+			for (size_t l = 0; l < num; ++l) {
+				total[l] += (part[l] + misses * lv.defaults[l]) / lv.n;
+			}
+		}
+
+		return min_score(total);
+	}
+
+	// Scans text n-gram by n-gram for all lengths at once and stops as soon as the best language
+	// leads the second one by @margin fraction of the second score, but not before @min_ngrams
+	// n-grams have been scanned. Without early exit result is the same as best().
+	size_t best_prefix(const S &text, double margin, size_t min_ngrams, size_t *scanned_ret = NULL) const {
+		const size_t num = m_num_languages;
+		const size_t num_levels = m_levels.size();
+		const size_t check_step = 32;
+
+		static thread_local std::vector<size_t> scratch;
+		scratch.assign(num * (num_levels + 1) + num_levels, 0);
+		size_t *total = scratch.data();
+		size_t *parts = total + num;
+		size_t *misses = parts + num * num_levels;
+
+		static thread_local std::vector<uint64_t> codes;
+		codes.assign(num_levels, 0);
+
+		auto sum = [&] () {
+			std::fill(total, total + num, 0);
+			for (size_t k = 0; k < num_levels; ++k) {
+				const level &lv = m_levels[k];
+				const size_t *part = parts + k * num;
+				for (size_t l = 0; l < num; ++l) {
+					total[l] += (part[l] + misses[k] * lv.defaults[l]) / lv.n;
+				}
+			}
+		};
+
+		size_t scanned = 0;
+		size_t next_check = std::max(min_ngrams, check_step);
+		for (size_t i = 0; i < text.size(); ++i) {
+			for (size_t k = 0; k < num_levels; ++k) {
+				const level &lv = m_levels[k];
+				typedef typename ngram_code<S>::unit unit;
+
+				codes[k] = ((codes[k] << unit::bits) | unit::code(text[i])) & ngram_code<S>::mask(lv.n);
+				if (i + 1 < lv.n)
+					continue;
+
+				if (!add_ranks(lv, codes[k], parts + k * num))
+					misses[k]++;
+				scanned++;
+			}
+
+			if (num > 1 && margin > 0 && scanned >= next_check && i + 1 < text.size()) {
+				next_check = scanned + check_step;
+
+				sum();
+				size_t first = min_score(total);
+				size_t second = first == 0 ? 1 : 0;
+				for (size_t l = 0; l < num; ++l) {
+					if (l != first && total[l] < total[second])
+						second = l;
+				}
+
+				if (total[second] - total[first] >= margin * total[second]) {
+					break;
+				}
+			}
+		}
+
+		if (scanned_ret)
+			*scanned_ret = scanned;
+
+		sum();
+		return min_score(total);
+	}
+
+private:
+	struct level_storage {
+		size_t n;
+		size_t mask;
+		std::vector<uint64_t> keys;
+		std::vector<uint32_t> rows;
+		std::vector<uint16_t> ranks;
+		std::vector<uint16_t> defaults;
+	};
+
+	struct storage {
+		std::vector<level_storage> levels;
+	};
+
+	size_t m_num_languages = 0;
+	std::vector<level> m_levels;
+
+	// owns memory levels point to: either built tables or mapped model file
+	std::shared_ptr<const void> m_storage;
+
+	// adds ranks of the n-gram to per-language scores, returns false if n-gram is not in any profile
+	bool add_ranks(const level &lv, uint64_t code, size_t *part) const {
+		const size_t num = m_num_languages;
+
+		size_t pos = ngram_table::hash(code) & lv.mask;
+		while (lv.keys[pos] != ngram_table::empty_key) {
+			if (lv.keys[pos] == code) {
+				const uint16_t *ranks = lv.ranks + (size_t)lv.rows[pos] * num;
+				for (size_t l = 0; l < num; ++l)
+					part[l] += ranks[l];
+				return true;
+			}
+
+			pos = (pos + 1) & lv.mask;
+		}
+
+		return false;
+	}
+
+	size_t min_score(const size_t *total) const {
+		size_t best = 0;
+		for (size_t l = 1; l < m_num_languages; ++l) {
+			if (total[l] < total[best])
+				best = l;
+		}
+
+		return best;
+	}
+
+	static void append(std::string *data, const void *ptr, size_t size) {
+		data->append((const char *)ptr, size);
+	}
+
+	static void align(std::string *data) {
+		data->resize((data->size() + 7) & ~7UL, '\0');
+	}
+
+	// moves @ptr to the next 8-byte boundary from @base, fails if it is past @end
+	static bool skip_padding(const char **ptr, const char *base, const char *end) {
+		size_t offset = (*ptr - base + 7) & ~7UL;
+		if (offset > (size_t)(end - base))
+			return false;
+
+		*ptr = base + offset;
+		return true;
+	}
+};
 
 template <typename S, typename D>
 class detector {
@@ -181,6 +912,20 @@ public:
 		for (auto &p: m_probs) {
 			p.second.sort();
 		}
+
+		compile();
+	}
+
+	// merges statistics collected by another detector, for example by another training thread
+	void merge(const detector &other) {
+		for (const auto &p: other.m_probs) {
+			auto it = m_probs.find(p.first);
+			if (it == m_probs.end()) {
+				m_probs.insert(p);
+			} else {
+				it->second.merge(p.second);
+			}
+		}
 	}
 
 	void reset_stats() {
@@ -189,7 +934,32 @@ public:
 		}
 	}
 
+	// detector which can be used for detection, raw n-gram counters are not copied
+	detector profile_copy() const {
+		detector ret;
+		for (const auto &p: m_probs) {
+			ret.m_probs.emplace(std::pair<D, probability<S>>(p.first, p.second.profile_copy()));
+		}
+		ret.m_names = m_names;
+		ret.m_fused = m_fused;
+		return ret;
+	}
+
+	// Detects language of the whole document, scanning stops early when one language
+	// leads the others by @margin, see fused_index::best_prefix()
+	D detect_document(const S &text, double margin, size_t min_ngrams) const {
+		if (!m_fused.empty()) {
+			return m_names[m_fused.best_prefix(text, margin, min_ngrams)];
+		}
+
+		return detect(text);
+	}
+
 	D detect(const S &text) const {
+		if (!m_fused.empty()) {
+			return m_names[m_fused.best(text)];
+		}
+
 		ssize_t min_score = -1;
 		D name;
 
@@ -212,17 +982,58 @@ public:
 	}
 
 	int save_file(const char *path) {
-		std::ofstream output(path, std::ios::trunc);
+		// do not overwrite statistics with empty set when only compiled model is loaded
+		if (!has_stats() && !m_fused.empty())
+			return -EINVAL;
+
+		// statistics are written into temporary file first, so readers never see partially written file
+		std::string tmp_path = std::string(path) + ".tmp";
+		std::ofstream output(tmp_path.c_str(), std::ios::trunc);
 		std::string content = save();
 
 		output.write(content.data(), content.size());
+		output.close();
 		if (!output.good())
 			return -1;
 
+		if (rename(tmp_path.c_str(), path) != 0)
+			return -errno;
+
 		return 0;
 	}
 
+	// compiled model only contains fused profiles, it can be used for detection,
+	// but not for learning, since raw n-gram statistics are not stored
+	int save_compiled_file(const char *path) const {
+		if (m_fused.empty())
+			return -ENOENT;
+
+		std::vector<std::string> names(m_names.begin(), m_names.end());
+		return m_fused.write(path, names);
+	}
+
+	bool has_stats() const {
+		return !m_probs.empty();
+	}
+
+	// languages of the last compiled or loaded model
+	const std::vector<D> &languages() const {
+		return m_names;
+	}
+
+	// loads either msgpack statistics or compiled model, format is detected by the file magic
 	int load_file(const char *path) {
+		if (fused_index<S>::is_compiled(path)) {
+			std::vector<std::string> names;
+			int err = m_fused.open(path, &names);
+			if (err)
+				return err;
+
+			m_probs.clear();
+			m_names.assign(names.begin(), names.end());
+			return 0;
+		}
+
 		std::ifstream input(path);
 		std::ostringstream ss;
 		ss << input.rdbuf();
@@ -240,6 +1051,11 @@ public:
 			return -EINVAL;
 		}
 
+		for (auto &p: m_probs) {
+			p.second.compile();
+		}
+		compile();
+
 		return 0;
 	}
 
@@ -247,6 +1063,24 @@ public:
 
 private:
 	std::map<D, probability<S>> m_probs;
+
+	std::vector<D> m_names;
+	fused_index<S> m_fused;
+
+	void compile() {
+		std::vector<const probability<S> *> probs;
+		m_names.clear();
+
+		for (auto &p: m_probs) {
+			m_names.push_back(p.first);
+			probs.push_back(&p.second);
+		}
+
+		size_t profile_limit = ngram<S>().profile_limit;
+		if (!m_fused.build(probs, profile_limit)) {
+			m_names.clear();
+		}
+	}
 };
 
 }} // namespace ioremap::warp
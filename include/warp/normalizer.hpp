@@ -0,0 +1,283 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_NORMALIZER_HPP
+#define __WARP_NORMALIZER_HPP
+
+#include "warp/utf8.hpp"
+
+#include <ribosome/lstring.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ioremap { namespace warp {
+
+/*
+ * Single pass table driven text normalizer: it lowercases letters, optionally folds
+ * ё into е, digits and unicode punctuation into separators, replaces every run
+ * of separators with single space and trims the result.
+ *
+ * Case of code points below case_table_size (Latin, Latin Extended, Greek and Cyrillic)
+ * is taken from the table which is filled once from ribosome case conversion,
+ * rare code points above it go to ribosome directly. Runs of ASCII letters
+ * are lowercased 16 bytes at a time.
+ *
+ * Folding is disabled by default. Detector tools and server language detection always use fold_text.
+ * Server endpoints fold request words only with 'fold' option, dictionaries and completion indexes
+ * built with --fold (warp_zpack, warp_completion) must be queried with it and vice versa.
+ */
+class normalizer {
+public:
+	enum {
+		fold_yo =		1<<0,	// ё -> е
+		fold_digits =		1<<1,	// ASCII digits are separators
+		fold_punctuation =	1<<2,	// non-ASCII punctuation and symbols are separators
+
+		// folding shared by builders and the server, see above
+		fold_text =		fold_yo | fold_punctuation,
+	};
+
+	static const uint32_t case_table_size = 0x530;
+
+	// ASCII and Unicode whitespace always is a separator, @separators are additional ASCII separator characters
+	normalizer(const std::string &separators = "", int flags = 0) : m_flags(flags) {
+		for (int c = 0; c < 0x80; ++c) {
+			m_ascii[c] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+		}
+
+		for (unsigned char c: std::string(" \t\n\r\f\v")) {
+			m_ascii[c] = 0;
+		}
+		for (unsigned char c: separators) {
+			if (c < 0x80)
+				m_ascii[c] = 0;
+		}
+		if (flags & fold_digits) {
+			for (int c = '0'; c <= '9'; ++c)
+				m_ascii[c] = 0;
+		}
+
+		// vectorized path only handles letters, so it is enabled if no letter is a separator
+		m_simd_letters = true;
+		for (int c = 'a'; c <= 'z'; ++c) {
+			if (!m_ascii[c] || !m_ascii[c + 'A' - 'a'])
+				m_simd_letters = false;
+		}
+	}
+
+	// ASCII character (less than 0x80) mapped to its lowercase form or 0 if it is a separator
+	char ascii(unsigned char c) const {
+		return m_ascii[c];
+	}
+
+	// code point mapped to its normalized form or 0 if it is a separator
+	uint32_t map(uint32_t c) const {
+		if (c < 0x80)
+			return (unsigned char)m_ascii[c];
+
+		if (is_space(c))
+			return 0;
+		if ((m_flags & fold_punctuation) && is_punctuation(c))
+			return 0;
+
+		c = lower(c);
+		if ((m_flags & fold_yo) && c == 0x451)
+			c = 0x435;
+
+		return c;
+	}
+
+	// number of leading ASCII letters of @ptr written lowercased into @out
+	size_t lower_letters(const unsigned char *ptr, size_t size, char *out) const {
+		size_t pos = 0;
+#if defined(__SSE2__)
+		if (!m_simd_letters)
+			return 0;
+
+		const __m128i case_bit = _mm_set1_epi8(0x20);
+		const __m128i before_a = _mm_set1_epi8('a' - 1);
+		const __m128i after_z = _mm_set1_epi8('z' + 1);
+		for (; pos + 16 <= size; pos += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(ptr + pos));
+			__m128i lv = _mm_or_si128(v, case_bit);
+
+			// signed comparison also rejects bytes with high bit set
+			__m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lv, before_a), _mm_cmplt_epi8(lv, after_z));
+			if (_mm_movemask_epi8(letter) != 0xffff)
+				break;
+
+			_mm_storeu_si128((__m128i *)(out + pos), lv);
+		}
+#else
+		(void) ptr;
+		(void) size;
+		(void) out;
+#endif
+		return pos;
+	}
+
+	// Appends normalized @text to @ret
+	void normalize(const char *text, size_t size, std::string *ret) const {
+		const unsigned char *ptr = (const unsigned char *)text;
+		const unsigned char *end = ptr + size;
+
+		size_t start = ret->size();
+		bool pending_space = false;
+
+		ret->reserve(start + size);
+		while (ptr < end) {
+			if (*ptr < 0x80) {
+				char c = m_ascii[*ptr];
+				if (!c) {
+					pending_space = true;
+					++ptr;
+					continue;
+				}
+
+				if (pending_space && ret->size() != start)
+					ret->push_back(' ');
+				pending_space = false;
+
+				char chunk[64];
+				size_t num;
+				do {
+					num = lower_letters(ptr, std::min<size_t>(end - ptr, sizeof(chunk)), chunk);
+					ret->append(chunk, num);
+					ptr += num;
+				} while (num == sizeof(chunk));
+
+				while (ptr < end && *ptr < 0x80 && (c = m_ascii[*ptr]) != 0) {
+					ret->push_back(c);
+					++ptr;
+				}
+				continue;
+			}
+
+			uint32_t code;
+			ptr += utf8::decode_one(ptr, end, &code);
+
+			code = map(code);
+			if (!code) {
+				pending_space = true;
+				continue;
+			}
+
+			if (pending_space && ret->size() != start)
+				ret->push_back(' ');
+			pending_space = false;
+
+			char tmp[4];
+			ret->append(tmp, utf8::encode_one(code, tmp));
+		}
+	}
+
+	std::string normalize(const char *text, size_t size) const {
+		std::string ret;
+		normalize(text, size, &ret);
+		return ret;
+	}
+
+	std::string normalize(const std::string &text) const {
+		return normalize(text.data(), text.size());
+	}
+
+	// non-ASCII whitespace and control characters, joiners and soft hyphen stay inside words
+	static bool is_space(uint32_t c) {
+		static const uint32_t ranges[][2] = {
+			{0x80, 0xa0}, {0x1680, 0x1680}, {0x180e, 0x180e}, {0x2000, 0x200b}, {0x2028, 0x202f},
+			{0x205f, 0x205f}, {0x3000, 0x3000}, {0xfeff, 0xfeff},
+		};
+
+		return in_ranges(ranges, sizeof(ranges) / sizeof(ranges[0]), c);
+	}
+
+	// non-ASCII punctuation and symbols, the same characters ICU word break does not put into words
+	static bool is_punctuation(uint32_t c) {
+		static const uint32_t ranges[][2] = {
+			{0xa1, 0xa9}, {0xab, 0xac}, {0xae, 0xb4}, {0xb6, 0xb9}, {0xbb, 0xbf}, {0xd7, 0xd7}, {0xf7, 0xf7},
+			{0x37e, 0x37e}, {0x387, 0x387}, {0x55a, 0x55f}, {0x589, 0x58a}, {0x5be, 0x5be}, {0x5c0, 0x5c0},
+			{0x5c3, 0x5c3}, {0x5c6, 0x5c6}, {0x5f3, 0x5f4}, {0x609, 0x60d}, {0x61b, 0x61f}, {0x66a, 0x66d},
+			{0x6d4, 0x6d4}, {0x964, 0x965}, {0x970, 0x970}, {0xe4f, 0xe4f}, {0xe5a, 0xe5b}, {0x10fb, 0x10fb},
+			{0x1360, 0x1368}, {0x166d, 0x166e}, {0x16eb, 0x16ed}, {0x17d4, 0x17d6}, {0x17d8, 0x17db},
+			{0x1800, 0x180a}, {0x2010, 0x2027}, {0x2030, 0x205e}, {0x207d, 0x207e}, {0x208d, 0x208e},
+			{0x20a0, 0x20cf}, {0x2100, 0x2101}, {0x2103, 0x2106}, {0x2108, 0x2109}, {0x2116, 0x2118},
+			{0x211e, 0x2123}, {0x2125, 0x2125}, {0x2127, 0x2127}, {0x2129, 0x2129}, {0x212e, 0x212e},
+			{0x2190, 0x2bff}, {0x2e00, 0x2e7f}, {0x3001, 0x3004}, {0x3008, 0x3020}, {0x3030, 0x3030},
+			{0x303d, 0x303d}, {0x30fb, 0x30fb}, {0xfd3e, 0xfd3f}, {0xfe10, 0xfe19}, {0xfe30, 0xfe6b},
+			{0xff01, 0xff0f}, {0xff1a, 0xff20}, {0xff3b, 0xff40}, {0xff5b, 0xff65}, {0xffe0, 0xffee},
+			{0x1f000, 0x1faff},
+		};
+
+		return in_ranges(ranges, sizeof(ranges) / sizeof(ranges[0]), c);
+	}
+
+	static uint32_t lower(uint32_t c) {
+		if (c < case_table_size)
+			return case_table()[c];
+
+		ribosome::lstring tmp(1, ribosome::letter(c));
+		ribosome::lstring lower = ribosome::lconvert::to_lower(tmp);
+		return lower.size() == 1 ? lower[0].l : c;
+	}
+
+private:
+	int m_flags;
+
+	// @ranges are sorted inclusive [first, last] pairs
+	static bool in_ranges(const uint32_t (*ranges)[2], size_t num, uint32_t c) {
+		size_t lo = 0, hi = num;
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+			if (c < ranges[mid][0]) {
+				hi = mid;
+			} else if (c > ranges[mid][1]) {
+				lo = mid + 1;
+			} else {
+				return true;
+			}
+		}
+
+		return false;
+	}
+	bool m_simd_letters;
+	char m_ascii[0x80];
+
+	static const std::vector<uint32_t> &case_table() {
+		static const std::vector<uint32_t> table = [] () {
+			std::vector<uint32_t> ret(case_table_size);
+			for (uint32_t c = 0; c < case_table_size; ++c) {
+				ribosome::lstring tmp(1, ribosome::letter(c));
+				ribosome::lstring lower = ribosome::lconvert::to_lower(tmp);
+
+				// letters which lowercase into several code points are left as is
+				ret[c] = lower.size() == 1 ? lower[0].l : c;
+			}
+			return ret;
+		}();
+
+		return table;
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_NORMALIZER_HPP */
@@ -5,8 +5,12 @@
 
 #include <ribosome/lstring.hpp>
 
+#include <algorithm>
+#include <climits>
 #include <fstream>
 #include <map>
+#include <set>
+#include <vector>
 
 namespace ioremap { namespace warp { namespace norvig {
 
@@ -61,6 +65,129 @@ private:
 	bool m_finished = true;
 };
 
+/*
+ * Storage for generated edit candidates.
+ * Every candidate is written into single contiguous letter buffer and is addressed
+ * by (offset, size) record, duplicates are dropped using flat open-addressing hash table
+ * of record indexes. Clearing arena keeps all allocated memory, so it is supposed
+ * to be reused (there is one per thread, see lang_model::thread_arena()).
+ */
+class edits_arena {
+public:
+	struct record {
+		uint32_t offset;
+		uint32_t size;
+		uint32_t hash;
+		int distance;
+	};
+
+	edits_arena() {
+		m_table.resize(1024);
+		m_mask = m_table.size() - 1;
+	}
+
+	void clear() {
+		m_letters.clear();
+		m_records.clear();
+		std::fill(m_table.begin(), m_table.end(), 0);
+	}
+
+	size_t size() const {
+		return m_records.size();
+	}
+
+	const record &at(size_t idx) const {
+		return m_records[idx];
+	}
+
+	const ribosome::letter *data(size_t idx) const {
+		return m_letters.data() + m_records[idx].offset;
+	}
+
+	ribosome::lstring str(size_t idx) const {
+		const ribosome::letter *ptr = data(idx);
+		return ribosome::lstring(ptr, ptr + m_records[idx].size);
+	}
+
+	// Reserves space for new candidate of @size letters at the end of the arena,
+	// returned pointer is valid until commit() or next start()
+	ribosome::letter *start(size_t size) {
+		m_pending = m_letters.size();
+		m_letters.resize(m_pending + size);
+		return m_letters.data() + m_pending;
+	}
+
+	// Either keeps last started candidate and returns true, or drops it if the same
+	// letter sequence has already been stored in the arena
+	bool commit(int distance) {
+		record rec;
+		rec.offset = m_pending;
+		rec.size = m_letters.size() - m_pending;
+		rec.hash = hash(m_letters.data() + m_pending, rec.size);
+		rec.distance = distance;
+
+		size_t pos = rec.hash & m_mask;
+		while (m_table[pos] != 0) {
+			const record &r = m_records[m_table[pos] - 1];
+			if (r.hash == rec.hash && r.size == rec.size &&
+					std::equal(m_letters.data() + r.offset, m_letters.data() + r.offset + r.size,
+						m_letters.data() + m_pending)) {
+				m_letters.resize(m_pending);
+				return false;
+			}
+
+			pos = (pos + 1) & m_mask;
+		}
+
+		m_records.push_back(rec);
+		m_table[pos] = m_records.size();
+
+		if (m_records.size() * 2 > m_table.size()) {
+			grow();
+		}
+
+		return true;
+	}
+
+	// Copy of the word candidates are being generated from, it can not point into
+	// arena itself, since letter buffer can be reallocated while new candidates are added
+	std::vector<ribosome::letter> &source() {
+		return m_source;
+	}
+
+private:
+	std::vector<ribosome::letter> m_letters;
+	std::vector<ribosome::letter> m_source;
+	std::vector<record> m_records;
+	std::vector<uint32_t> m_table;
+	size_t m_mask;
+	size_t m_pending = 0;
+
+	static uint32_t hash(const ribosome::letter *ptr, size_t size) {
+		uint32_t h = 2166136261U;
+		for (size_t i = 0; i < size; ++i) {
+			h ^= ptr[i].l;
+			h *= 16777619U;
+		}
+
+		return h ^ (h >> 15);
+	}
+
+	void grow() {
+		m_table.assign(m_table.size() * 2, 0);
+		m_mask = m_table.size() - 1;
+
+		for (size_t i = 0; i < m_records.size(); ++i) {
+			size_t pos = m_records[i].hash & m_mask;
+			while (m_table[pos] != 0) {
+				pos = (pos + 1) & m_mask;
+			}
+
+			m_table[pos] = i + 1;
+		}
+	}
+};
+
 class lang_model {
 public:
 	lang_model() {}
@@ -74,98 +201,128 @@ public:
 		return m_emod.load_transform_replace(path);
 	}
 
-	std::set<ribosome::lstring> edits1(const ribosome::lstring &vs) {
-		std::set<ribosome::lstring> ret;
+	const warp::error_model::letter_error_model &error_model() const {
+		return m_emod;
+	}
+
+	static edits_arena &thread_arena() {
+		static thread_local edits_arena arena;
+		return arena;
+	}
+
+	// Lazily generates all unique variants of @vs which are at most @max_distance edits away,
+	// @func is called as soon as new candidate is produced:
+	//    bool func(const ribosome::letter *ptr, size_t size, int distance)
+	// it has to return false to stop generation.
+	//
+	// Candidates are stored in per-thread arena, thus @func must not start another generation
+	// on the same thread.
+	template <typename Func>
+	void for_each_edit(const ribosome::lstring &vs, int max_distance, Func func) const {
+		for_each_edit(vs, max_distance, thread_arena(), func);
+	}
+
+	template <typename Func>
+	void for_each_edit(const ribosome::lstring &vs, int max_distance, edits_arena &arena, Func func) const {
+		arena.clear();
+		if (max_distance < 1)
+			return;
+
+		if (!generate(vs.data(), vs.size(), 1, arena, func))
+			return;
+
+		size_t begin = 0;
+		for (int distance = 2; distance <= max_distance; ++distance) {
+			size_t end = arena.size();
 
-		std::vector<std::pair<ribosome::lstring, ribosome::lstring>> splits;
-		splits.reserve(vs.size());
-		for (size_t i = 0; i <= vs.size(); ++i) {
-			ribosome::lstring l(vs.begin(), vs.begin() + i);
-			ribosome::lstring r(vs.begin() + i, vs.end());
-			splits.emplace_back(std::make_pair(std::move(l), std::move(r)));
+			for (size_t i = begin; i < end; ++i) {
+				auto &src = arena.source();
+				src.assign(arena.data(i), arena.data(i) + arena.at(i).size);
+
+				if (!generate(src.data(), src.size(), distance, arena, func))
+					return;
+			}
+
+			begin = end;
 		}
+	}
 
-		// deletes
-		for (auto &p: splits) {
-			if (p.second.size() > 0) {
-				ribosome::lstring tmp;
-				tmp.reserve(p.first.size() + p.second.size() - 1);
-				const ribosome::lstring &a = p.first;
-				const ribosome::lstring &b = p.second;
-				tmp.insert(tmp.begin(), a.begin(), a.end());
-				tmp.insert(tmp.end(), b.begin() + 1, b.end());
-				ret.emplace(tmp);
+	std::set<ribosome::lstring> edits1(const ribosome::lstring &vs) const {
+		return edits(vs, 1);
+	}
+
+	std::set<ribosome::lstring> edits2(const ribosome::lstring &vs) const {
+		return edits(vs, 2);
+	}
+
+private:
+	warp::error_model::letter_error_model m_emod;
+
+	std::set<ribosome::lstring> edits(const ribosome::lstring &vs, int max_distance) const {
+		std::set<ribosome::lstring> ret;
+
+		for_each_edit(vs, max_distance, [&] (const ribosome::letter *ptr, size_t size, int) -> bool {
+					ret.emplace(ptr, ptr + size);
+					return true;
+				});
+
+		return ret;
+	}
+
+	template <typename Func>
+	bool generate(const ribosome::letter *w, size_t size, int distance, edits_arena &arena, Func &func) const {
+		auto emit = [&] () -> bool {
+			if (arena.commit(distance)) {
+				size_t idx = arena.size() - 1;
+				return func(arena.data(idx), arena.at(idx).size, distance);
 			}
+
+			return true;
+		};
+
+		// deletes
+		for (size_t i = 0; i < size; ++i) {
+			ribosome::letter *dst = arena.start(size - 1);
+			std::copy(w, w + i, dst);
+			std::copy(w + i + 1, w + size, dst + i);
+			if (!emit())
+				return false;
 		}
 
 		// transposes
-		for (auto &p: splits) {
-			if (p.second.size() > 1) {
-				ribosome::lstring tmp;
-				tmp.reserve(p.first.size() + p.second.size());
-				const ribosome::lstring &a = p.first;
-				const ribosome::lstring &b = p.second;
-				tmp.insert(tmp.begin(), a.begin(), a.end());
-				tmp.push_back(b[1]);
-				tmp.push_back(b[0]);
-				tmp.insert(tmp.end(), b.begin() + 2, b.end());
-				ret.emplace(tmp);
-			}
+		for (size_t i = 0; i + 1 < size; ++i) {
+			ribosome::letter *dst = arena.start(size);
+			std::copy(w, w + size, dst);
+			std::swap(dst[i], dst[i + 1]);
+			if (!emit())
+				return false;
 		}
 
 		// replaces
-		for (auto &p: splits) {
-			if (p.second.size() > 0 && p.first.size() > 0) {
-
-				const ribosome::lstring &a = p.first;
-				const ribosome::lstring &b = p.second;
-
-				for (auto &l: m_emod.transform(b.front(), a.size())) {
-					ribosome::lstring tmp;
-					tmp.reserve(a.size() + b.size());
-					tmp.insert(tmp.begin(), a.begin(), a.end());
-					tmp.push_back(l);
-					tmp.insert(tmp.end(), b.begin() + 1, b.end());
-					ret.emplace(tmp);
-				}
+		for (size_t i = 1; i < size; ++i) {
+			for (auto &l: m_emod.transform(w[i], i)) {
+				ribosome::letter *dst = arena.start(size);
+				std::copy(w, w + size, dst);
+				dst[i] = l;
+				if (!emit())
+					return false;
 			}
 		}
 
 		// inserts
-		for (auto &p: splits) {
-			if (p.first.size() > 0) {
-				const ribosome::lstring &a = p.first;
-				const ribosome::lstring &b = p.second;
-
-				for (auto &l: m_emod.transform(a.back(), a.size())) {
-					ribosome::lstring tmp;
-					tmp.reserve(a.size() + b.size() + 1);
-					tmp.insert(tmp.begin(), a.begin(), a.end());
-					tmp.push_back(l);
-					tmp.insert(tmp.end(), b.begin(), b.end());
-					ret.emplace(tmp);
-				}
+		for (size_t i = 1; i <= size; ++i) {
+			for (auto &l: m_emod.transform(w[i - 1], i)) {
+				ribosome::letter *dst = arena.start(size + 1);
+				std::copy(w, w + i, dst);
+				dst[i] = l;
+				std::copy(w + i, w + size, dst + i + 1);
+				if (!emit())
+					return false;
 			}
 		}
 
-		return ret;
-	}
-
-	std::set<ribosome::lstring> edits2(const ribosome::lstring &vs) {
-		std::set<ribosome::lstring> ret;
-
-		std::set<ribosome::lstring> e1 = edits1(vs);
-
-		for (auto &w: e1) {
-			std::set<ribosome::lstring> tmp = edits1(w);
-			ret.insert(tmp.begin(), tmp.end());
-		}
-
-		return ret;
+		return true;
 	}
-
-private:
-	warp::error_model::letter_error_model m_emod;
 };
 
 }}} // namespace ioremap::fuzzy::norvig
@@ -18,6 +18,7 @@
 #define __IOREMAP_WARP_PACK_HPP
 
 #include "warp/database.hpp"
+#include "warp/utf8.hpp"
 #include "warp/utils.hpp"
 
 #include <ribosome/error.hpp>
@@ -43,7 +44,7 @@ public:
 		std::set<std::string> ngram_strings;
 		auto ngrams = warp::ngram<ribosome::lstring>::split(wf.lw, 2);
 		for (auto &n: ngrams) {
-			std::string ns = ribosome::lconvert::to_string(n);
+			std::string ns = warp::utf8::to_string(n);
 			ngram_strings.insert(ns);
 		}
 		
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_RESPONSE_CACHE_HPP
+#define __WARP_RESPONSE_CACHE_HPP
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace ioremap { namespace warp {
+
+/*
+ * LRU cache of whole replies with byte budget and time to live.
+ *
+ * Key is endpoint, request options which change the reply and the request body itself, so a hit
+ * always means byte-identical request, hash collisions can not return a reply of another request.
+ * Replies are shared, lookup only copies a pointer under the lock. Entries older than TTL are dropped on lookup.
+ */
+class response_cache {
+public:
+	struct stats {
+		uint64_t	hits = 0;
+		uint64_t	misses = 0;
+		uint64_t	inserts = 0;
+		uint64_t	evictions = 0;
+		uint64_t	expired = 0;
+		uint64_t	entries = 0;
+		uint64_t	bytes = 0;
+	};
+
+	typedef std::shared_ptr<const std::string> reply_ptr;
+
+	// @max_bytes is a budget for keys and replies, @ttl_seconds is lifetime of every entry
+	response_cache(size_t max_bytes, long ttl_seconds) : m_max_bytes(max_bytes), m_ttl(ttl_seconds) {
+	}
+
+	// @options are the request options which affect reply, like format or query flags
+	static std::string key(const char *endpoint, const std::string &options, const char *data, size_t size) {
+		std::string ret;
+		ret.reserve(strlen(endpoint) + options.size() + size + 2);
+
+		ret.append(endpoint);
+		ret.push_back('\0');
+		ret += options;
+		ret.push_back('\0');
+		ret.append(data, size);
+		return ret;
+	}
+
+	// null if there is no fresh reply for @key
+	reply_ptr get(const std::string &key, const char **content_type) {
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		auto it = m_index.find(key);
+		if (it == m_index.end()) {
+			m_stats.misses++;
+			return reply_ptr();
+		}
+
+		entry &e = it->second;
+		if (std::chrono::steady_clock::now() >= e.expires) {
+			erase(it);
+			m_stats.expired++;
+			m_stats.misses++;
+			return reply_ptr();
+		}
+
+		m_lru.splice(m_lru.begin(), m_lru, e.lru);
+
+		*content_type = e.content_type;
+		m_stats.hits++;
+		return e.reply;
+	}
+
+	// @content_type must be a static string, @reply is shared with the caller and is not copied
+	void insert(const std::string &key, const reply_ptr &reply, const char *content_type) {
+		size_t size = entry_size(key.size(), reply->size());
+		if (size > m_max_bytes)
+			return;
+
+		std::lock_guard<std::mutex> guard(m_lock);
+
+		auto it = m_index.find(key);
+		if (it != m_index.end())
+			erase(it);
+
+		while (m_stats.bytes + size > m_max_bytes && !m_lru.empty()) {
+			erase(m_index.find(*m_lru.back()));
+			m_stats.evictions++;
+		}
+
+		it = m_index.emplace(key, entry()).first;
+
+		entry &e = it->second;
+		e.reply = reply;
+		e.content_type = content_type;
+		e.expires = std::chrono::steady_clock::now() + m_ttl;
+
+		// nodes of unordered_map never move, so LRU list points to the keys stored in the index
+		m_lru.push_front(&it->first);
+		e.lru = m_lru.begin();
+
+		m_stats.inserts++;
+		m_stats.entries++;
+		m_stats.bytes += size;
+	}
+
+	struct stats get_stats() const {
+		std::lock_guard<std::mutex> guard(m_lock);
+		return m_stats;
+	}
+
+	// Appends cache statistics in Prometheus text format to @out
+	void prometheus(std::string *out) const {
+		struct stats st = get_stats();
+
+		const struct {
+			const char	*name;
+			const char	*type;
+			uint64_t	value;
+		} values[] = {
+			{"warp_response_cache_hits_total", "counter", st.hits},
+			{"warp_response_cache_misses_total", "counter", st.misses},
+			{"warp_response_cache_inserts_total", "counter", st.inserts},
+			{"warp_response_cache_evictions_total", "counter", st.evictions},
+			{"warp_response_cache_expired_total", "counter", st.expired},
+			{"warp_response_cache_entries", "gauge", st.entries},
+			{"warp_response_cache_bytes", "gauge", st.bytes},
+		};
+
+		for (const auto &v: values) {
+			char tmp[256];
+			snprintf(tmp, sizeof(tmp), "# TYPE %s %s\n%s %llu\n", v.name, v.type, v.name,
+					(unsigned long long)v.value);
+			out->append(tmp);
+		}
+	}
+
+private:
+	struct entry {
+		reply_ptr	reply;
+		const char	*content_type;
+		std::chrono::steady_clock::time_point expires;
+		std::list<const std::string *>::iterator lru;
+	};
+
+	size_t m_max_bytes;
+	std::chrono::seconds m_ttl;
+
+	mutable std::mutex m_lock;
+	std::list<const std::string *> m_lru;
+	std::unordered_map<std::string, entry> m_index;
+	struct stats m_stats;
+
+	static size_t entry_size(size_t key_size, size_t reply_size) {
+		return key_size + reply_size + sizeof(entry) + 64;
+	}
+
+	void erase(std::unordered_map<std::string, entry>::iterator it) {
+		m_stats.entries--;
+		m_stats.bytes -= entry_size(it->first.size(), it->second.reply->size());
+
+		m_lru.erase(it->second.lru);
+		m_index.erase(it);
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_RESPONSE_CACHE_HPP */
@@ -1,14 +1,35 @@
 #pragma once
 
 #include "warp/jsonvalue.hpp"
+#include "warp/metrics.hpp"
+#include "warp/response_cache.hpp"
 
 #include <swarm/logger.hpp>
 #include <thevoid/stream.hpp>
 
+#include <chrono>
+#include <cstdarg>
+#include <functional>
+
 namespace ioremap { namespace thevoid {
 
-template <typename Server>
-struct simple_request_stream_error : public thevoid::simple_request_stream<Server> {
+/*
+ * Error and reply helpers for any request stream type.
+ *
+ * Request statistics are recorded into server metrics (Server::metrics()) when reply is sent,
+ * handlers fill in endpoint, language and other fields through stats(). Languages not accepted
+ * by Server::known_language() are recorded as "other".
+ * Replies are cached in Server::cache() if it is not null.
+ */
+template <typename Server, typename Stream>
+struct request_stream_error : public Stream {
+	request_stream_error() : m_start(std::chrono::steady_clock::now()) {
+	}
+
+	warp::request_stats &stats() {
+		return m_stats;
+	}
+
 	void send_error(int status, int error, const char *fmt, ...) {
 		va_list args;
 		va_start(args, fmt);
@@ -29,15 +50,159 @@ struct simple_request_stream_error : public thevoid::simple_request_stream<Serve
 
 		va_end(args);
 
-		std::string data = val.ToString();
+		m_stats.error = true;
+		send_json(status, val.ToString());
+	}
 
+	void send_json(int status, std::string &&data) {
+		send_reply_body(status, "text/json", std::move(data));
+	}
+
+	// @data is moved into the reply as is, it is not copied
+	void send_reply_body(int status, const char *content_type, std::string &&data) {
 		thevoid::http_response http_reply;
 		http_reply.set_code(status);
 		http_reply.headers().set_content_length(data.size());
-		http_reply.headers().set_content_type("text/json");
+		http_reply.headers().set_content_type(content_type);
+
+		m_stats.bytes_out += data.size();
+		record_stats();
 
 		this->send_reply(std::move(http_reply), std::move(data));
 	}
+
+	/*
+	 * Sends reply cached for the request body and @options (everything else which changes the reply)
+	 * and returns true. Otherwise the key is kept and send_cacheable_reply() stores the reply built for this request.
+	 */
+	bool send_cached_reply(const char *endpoint, const std::string &options, const char *data, size_t size) {
+		warp::response_cache *cache = this->server()->cache();
+		if (!cache)
+			return false;
+
+		m_cache_key = warp::response_cache::key(endpoint, options, data, size);
+
+		const char *content_type;
+		warp::response_cache::reply_ptr reply = cache->get(m_cache_key, &content_type);
+		if (!reply)
+			return false;
+
+		send_shared_reply_body(content_type, std::move(reply));
+		return true;
+	}
+
+	// Sends successful reply and stores it in the cache if send_cached_reply() has been called for the request,
+	// cached and sent reply is the same buffer
+	void send_cacheable_reply(const char *content_type, std::string &&data) {
+		if (m_cache_key.empty()) {
+			send_reply_body(swarm::http_response::ok, content_type, std::move(data));
+			return;
+		}
+
+		auto reply = std::make_shared<const std::string>(std::move(data));
+		this->server()->cache()->insert(m_cache_key, reply, content_type);
+		send_shared_reply_body(content_type, std::move(reply));
+	}
+
+	// reply buffer is shared with the cache, it is referenced until the reply has been sent
+	void send_shared_reply_body(const char *content_type, warp::response_cache::reply_ptr &&reply) {
+		thevoid::http_response http_reply;
+		http_reply.set_code(swarm::http_response::ok);
+		http_reply.headers().set_content_length(reply->size());
+		http_reply.headers().set_content_type(content_type);
+
+		m_stats.bytes_out += reply->size();
+		record_stats();
+
+		boost::asio::const_buffer buffer(reply->data(), reply->size());
+		auto self = this->shared_from_this();
+		this->send_headers(std::move(http_reply), buffer,
+				[this, self, reply] (const boost::system::error_code &err) {
+					this->close(err);
+				});
+	}
+
+	void send_empty_reply(int status) {
+		record_stats();
+		this->send_reply(status);
+	}
+
+	/*
+	 * Streaming reply without content length: records are produced by @next one at a time,
+	 * the next record is only produced when the previous one has been sent, so just one record
+	 * is kept in memory. @next returns false when there are no more records, connection is closed then.
+	 * Request buffer and the handler stay alive until the last record has been sent.
+	 */
+	void send_records(const char *content_type, std::function<bool (std::string *)> &&next) {
+		m_next_record = std::move(next);
+
+		thevoid::http_response http_reply;
+		http_reply.set_code(swarm::http_response::ok);
+		http_reply.headers().set_content_type(content_type);
+		http_reply.headers().set_keep_alive(false);
+
+		auto self = this->shared_from_this();
+		this->send_headers(std::move(http_reply), [this, self] (const boost::system::error_code &err) {
+					send_next_record(err);
+				});
+	}
+
+private:
+	std::chrono::steady_clock::time_point m_start;
+	warp::request_stats m_stats;
+	bool m_stats_recorded = false;
+
+	std::string m_cache_key;
+
+	std::function<bool (std::string *)> m_next_record;
+
+	void record_stats() {
+		if (m_stats_recorded)
+			return;
+		m_stats_recorded = true;
+
+		if (m_stats.endpoint.empty())
+			m_stats.endpoint = "unknown";
+
+		// language often comes from the request, every distinct value would be a new series
+		if (!m_stats.language.empty() && !this->server()->known_language(m_stats.language))
+			m_stats.language = "other";
+
+		m_stats.duration_us = std::chrono::duration_cast<std::chrono::microseconds>(
+				std::chrono::steady_clock::now() - m_start).count();
+		this->server()->metrics().record(m_stats);
+	}
+
+	void send_next_record(const boost::system::error_code &err) {
+		if (err) {
+			m_stats.error = true;
+			record_stats();
+			this->close(err);
+			return;
+		}
+
+		std::string record;
+		if (!m_next_record(&record)) {
+			record_stats();
+			this->close(boost::system::error_code());
+			return;
+		}
+
+		m_stats.bytes_out += record.size();
+
+		auto self = this->shared_from_this();
+		this->send_data(std::move(record), [this, self] (const boost::system::error_code &err) {
+					send_next_record(err);
+				});
+	}
+};
+
+template <typename Server>
+struct simple_request_stream_error : public request_stream_error<Server, thevoid::simple_request_stream<Server>> {
+};
+
+template <typename Server>
+struct buffered_request_stream_error : public request_stream_error<Server, thevoid::buffered_request_stream<Server>> {
 };
 
 }}
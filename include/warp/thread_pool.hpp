@@ -0,0 +1,101 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_THREAD_POOL_HPP
+#define __WARP_THREAD_POOL_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Fixed size pool of compute threads, it is used to run CPU heavy work
+ * outside of the network threads. Pending tasks are dropped when pool is destroyed.
+ */
+class thread_pool {
+public:
+	thread_pool(size_t num) {
+		if (num == 0)
+			num = 1;
+
+		for (size_t i = 0; i < num; ++i) {
+			m_threads.emplace_back(std::bind(&thread_pool::run, this));
+		}
+	}
+
+	thread_pool(const thread_pool &) = delete;
+	thread_pool &operator=(const thread_pool &) = delete;
+
+	~thread_pool() {
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_stop = true;
+			m_tasks.clear();
+		}
+		m_wait.notify_all();
+
+		for (auto &t: m_threads) {
+			t.join();
+		}
+	}
+
+	void schedule(std::function<void ()> &&task) {
+		{
+			std::unique_lock<std::mutex> guard(m_lock);
+			m_tasks.emplace_back(std::move(task));
+		}
+		m_wait.notify_one();
+	}
+
+	size_t size() const {
+		return m_threads.size();
+	}
+
+private:
+	std::vector<std::thread> m_threads;
+
+	std::mutex m_lock;
+	std::condition_variable m_wait;
+	std::deque<std::function<void ()>> m_tasks;
+	bool m_stop = false;
+
+	void run() {
+		while (true) {
+			std::function<void ()> task;
+
+			{
+				std::unique_lock<std::mutex> guard(m_lock);
+				m_wait.wait(guard, [this] { return m_stop || !m_tasks.empty(); });
+				if (m_stop)
+					return;
+
+				task = std::move(m_tasks.front());
+				m_tasks.pop_front();
+			}
+
+			task();
+		}
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_THREAD_POOL_HPP */
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_TOKENIZER_HPP
+#define __WARP_TOKENIZER_HPP
+
+#include "warp/normalizer.hpp"
+#include "warp/utf8.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Word span in the source text and its lowercased form in tokenizer::normalized()
+ */
+struct token {
+	uint32_t	offset;
+	uint32_t	size;
+	uint32_t	norm_offset;
+	uint32_t	norm_size;
+};
+
+/*
+ * Single pass tokenizer which does not copy source text: words are returned as spans,
+ * lowercased words are written into one normalized buffer separated by single space,
+ * so the whole buffer is the normalized text and every word is a slice of it.
+ *
+ * Letters are lowercased and separators are detected by warp::normalizer, besides ASCII @separators
+ * every non-ASCII whitespace, punctuation and symbol separates words, like ICU word break does.
+ */
+class tokenizer {
+public:
+	// whitespace always separates words, @separators are additional ASCII separator characters,
+	// @flags are normalizer folding flags
+	tokenizer(const std::string &separators = "", int flags = 0) :
+		m_normalizer(separators, flags | normalizer::fold_punctuation) {
+	}
+
+	void tokenize(const char *text, size_t size) {
+		m_tokens.clear();
+		m_norm.clear();
+		m_norm.reserve(size + 1);
+
+		const unsigned char *start = (const unsigned char *)text;
+		const unsigned char *ptr = start;
+		const unsigned char *end = start + size;
+		bool in_word = false;
+
+		while (ptr < end) {
+			unsigned char c = *ptr;
+
+			if (c < 0x80) {
+				char lc = m_normalizer.ascii(c);
+				if (!lc) {
+					if (in_word) {
+						finish_token(ptr - start);
+						in_word = false;
+					}
+
+					++ptr;
+					continue;
+				}
+
+				if (!in_word) {
+					start_token(ptr - start);
+					in_word = true;
+				}
+
+				char chunk[64];
+				size_t num, total = 0;
+				do {
+					num = m_normalizer.lower_letters(ptr, std::min<size_t>(end - ptr, sizeof(chunk)), chunk);
+					m_norm.append(chunk, num);
+					ptr += num;
+					total += num;
+				} while (num == sizeof(chunk));
+
+				if (total == 0) {
+					m_norm.push_back(lc);
+					++ptr;
+				}
+				continue;
+			}
+
+			const unsigned char *letter_start = ptr;
+			uint32_t code;
+			ptr += utf8::decode_one(ptr, end, &code);
+
+			code = m_normalizer.map(code);
+			if (!code) {
+				if (in_word) {
+					finish_token(letter_start - start);
+					in_word = false;
+				}
+				continue;
+			}
+
+			if (!in_word) {
+				start_token(letter_start - start);
+				in_word = true;
+			}
+
+			char tmp[4];
+			m_norm.append(tmp, utf8::encode_one(code, tmp));
+		}
+
+		if (in_word)
+			finish_token(ptr - start);
+	}
+
+	void tokenize(const std::string &text) {
+		tokenize(text.data(), text.size());
+	}
+
+	// Length of the longest prefix of @text which ends with a separator. Words and UTF-8 sequences
+	// never cross that position, so text received in chunks can be tokenized prefix by prefix.
+	// If there is no separator in the last @max_tail bytes, text is cut at UTF-8 sequence boundary
+	// instead (splitting the word), so the unfinished tail never grows above @max_tail.
+	size_t complete_prefix(const char *text, size_t size, size_t max_tail) const {
+		size_t pos = size;
+		while (pos > 0 && size - pos < max_tail) {
+			unsigned char c = text[pos - 1];
+			if (c < 0x80 && !m_normalizer.ascii(c))
+				return pos;
+
+			--pos;
+		}
+
+		if (pos == 0)
+			return 0;
+
+		return utf8::boundary(text, size);
+	}
+
+	const std::vector<token> &tokens() const {
+		return m_tokens;
+	}
+
+	// all lowercased words separated by single space
+	const std::string &normalized() const {
+		return m_norm;
+	}
+
+	const char *data(const token &t) const {
+		return m_norm.data() + t.norm_offset;
+	}
+
+	std::string word(const token &t) const {
+		return m_norm.substr(t.norm_offset, t.norm_size);
+	}
+
+private:
+	normalizer m_normalizer;
+
+	std::vector<token> m_tokens;
+	std::string m_norm;
+
+	void start_token(size_t offset) {
+		if (m_tokens.size())
+			m_norm.push_back(' ');
+
+		token t;
+		t.offset = offset;
+		t.size = 0;
+		t.norm_offset = m_norm.size();
+		t.norm_size = 0;
+		m_tokens.push_back(t);
+	}
+
+	void finish_token(size_t offset) {
+		token &t = m_tokens.back();
+		t.size = offset - t.offset;
+		t.norm_size = m_norm.size() - t.norm_offset;
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_TOKENIZER_HPP */
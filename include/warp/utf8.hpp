@@ -0,0 +1,317 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_UTF8_HPP
+#define __WARP_UTF8_HPP
+
+#include <ribosome/lstring.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace ioremap { namespace warp { namespace utf8 {
+
+/*
+ * Table driven UTF-8 <-> UTF-32 codec working on strings of 32-bit letters
+ * (both ribosome::lstring and warp::lstring).
+ *
+ * Decoder validates input according to RFC 3629: overlong forms, surrogates,
+ * code points above U+10FFFF and truncated sequences are replaced with U+FFFD,
+ * every bad byte is replaced separately. Runs of ASCII bytes are widened
+ * 16 (SSE2) or 32 (AVX2) bytes at a time.
+ */
+static const uint32_t replacement = 0xfffd;
+
+// sequence length by lead byte, 0 means byte can not start a sequence
+static const uint8_t sequence_length[256] = {
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// payload bits of the lead byte by sequence length
+static const uint8_t lead_mask[5] = { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+
+// valid range of the second byte, it rejects overlong forms, surrogates and too large code points
+static inline bool second_byte_ok(unsigned char lead, unsigned char b) {
+	switch (lead) {
+	case 0xe0: return b >= 0xa0 && b <= 0xbf;
+	case 0xed: return b >= 0x80 && b <= 0x9f;
+	case 0xf0: return b >= 0x90 && b <= 0xbf;
+	case 0xf4: return b >= 0x80 && b <= 0x8f;
+	default: return (b & 0xc0) == 0x80;
+	}
+}
+
+// decodes one sequence at @ptr, returns number of consumed bytes, invalid sequence consumes one byte
+static inline size_t decode_one(const unsigned char *ptr, const unsigned char *end, uint32_t *code) {
+	unsigned char lead = ptr[0];
+	size_t len = sequence_length[lead];
+
+	if (len == 1) {
+		*code = lead;
+		return 1;
+	}
+
+	if (len == 0 || (size_t)(end - ptr) < len || !second_byte_ok(lead, ptr[1])) {
+		*code = replacement;
+		return 1;
+	}
+
+	uint32_t c = lead & lead_mask[len];
+	for (size_t i = 1; i < len; ++i) {
+		if ((ptr[i] & 0xc0) != 0x80) {
+			*code = replacement;
+			return 1;
+		}
+
+		c = (c << 6) | (ptr[i] & 0x3f);
+	}
+
+	*code = c;
+	return len;
+}
+
+// number of leading ASCII bytes which are widened into @out with SIMD
+template <typename L>
+static inline size_t widen_ascii(const unsigned char *ptr, size_t size, L *out) {
+	static_assert(sizeof(L) == sizeof(uint32_t), "letter must be 32-bit code point");
+	size_t pos = 0;
+
+#if defined(__AVX2__)
+	for (; pos + 32 <= size; pos += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(ptr + pos));
+		if (_mm256_movemask_epi8(v))
+			break;
+
+		for (int i = 0; i < 4; ++i) {
+			__m128i part = _mm_loadl_epi64((const __m128i *)(ptr + pos + i * 8));
+			_mm256_storeu_si256((__m256i *)(out + pos + i * 8), _mm256_cvtepu8_epi32(part));
+		}
+	}
+#endif
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	for (; pos + 16 <= size; pos += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(ptr + pos));
+		if (_mm_movemask_epi8(v))
+			break;
+
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+		_mm_storeu_si128((__m128i *)(out + pos + 0), _mm_unpacklo_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(out + pos + 4), _mm_unpackhi_epi16(lo, zero));
+		_mm_storeu_si128((__m128i *)(out + pos + 8), _mm_unpacklo_epi16(hi, zero));
+		_mm_storeu_si128((__m128i *)(out + pos + 12), _mm_unpackhi_epi16(hi, zero));
+	}
+#endif
+	(void) out;
+
+	return pos;
+}
+
+// Appends letters decoded from @text to @ret, returns number of replaced invalid bytes
+template <typename S>
+static inline size_t decode(const char *text, size_t size, S *ret) {
+	typedef typename S::value_type letter;
+
+	const unsigned char *ptr = (const unsigned char *)text;
+	const unsigned char *end = ptr + size;
+
+	// there are never more letters than bytes
+	size_t start = ret->size();
+	ret->resize(start + size);
+	letter *out = &(*ret)[0] + start;
+	letter *out_start = out;
+
+	size_t errors = 0;
+	while (ptr < end) {
+		size_t ascii = widen_ascii(ptr, end - ptr, out);
+		ptr += ascii;
+		out += ascii;
+
+		while (ptr < end && *ptr < 0x80) {
+			*out++ = letter(*ptr++);
+		}
+
+		while (ptr < end && *ptr >= 0x80) {
+			uint32_t code;
+			ptr += decode_one(ptr, end, &code);
+			errors += code == replacement;
+			*out++ = letter(code);
+		}
+	}
+
+	ret->resize(start + (out - out_start));
+	return errors;
+}
+
+template <typename S>
+static inline S decode(const char *text, size_t size) {
+	S ret;
+	decode(text, size, &ret);
+	return ret;
+}
+
+static inline ribosome::lstring to_lstring(const char *text, size_t size) {
+	return decode<ribosome::lstring>(text, size);
+}
+
+static inline ribosome::lstring to_lstring(const std::string &text) {
+	return decode<ribosome::lstring>(text.data(), text.size());
+}
+
+// Returns true if @text is valid UTF-8, otherwise @error_offset is set to the first invalid byte
+static inline bool valid(const char *text, size_t size, size_t *error_offset = NULL) {
+	const unsigned char *ptr = (const unsigned char *)text;
+	const unsigned char *end = ptr + size;
+
+	while (ptr < end) {
+#if defined(__SSE2__)
+		while (end - ptr >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ptr)))
+			ptr += 16;
+		if (ptr == end)
+			break;
+#endif
+		uint32_t code;
+		size_t len = decode_one(ptr, end, &code);
+		if (code == replacement && !(len == 3 && ptr[0] == 0xef && ptr[1] == 0xbf && ptr[2] == 0xbd)) {
+			if (error_offset)
+				*error_offset = (const char *)ptr - text;
+			return false;
+		}
+
+		ptr += len;
+	}
+
+	return true;
+}
+
+// Largest length not above @size which does not cut the last UTF-8 sequence of @text in the middle
+static inline size_t boundary(const char *text, size_t size) {
+	for (size_t back = 1; back <= 4 && back <= size; ++back) {
+		unsigned char c = text[size - back];
+		if ((c & 0xc0) == 0x80)
+			continue;
+
+		return sequence_length[c] > back ? size - back : size;
+	}
+
+	return size;
+}
+
+// encodes one code point into @out, which must have at least 4 bytes, returns number of bytes
+static inline size_t encode_one(uint32_t c, char *out) {
+	if (c < 0x80) {
+		out[0] = c;
+		return 1;
+	}
+	if (c < 0x800) {
+		out[0] = 0xc0 | (c >> 6);
+		out[1] = 0x80 | (c & 0x3f);
+		return 2;
+	}
+	if (c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff))
+		c = replacement;
+	if (c < 0x10000) {
+		out[0] = 0xe0 | (c >> 12);
+		out[1] = 0x80 | ((c >> 6) & 0x3f);
+		out[2] = 0x80 | (c & 0x3f);
+		return 3;
+	}
+
+	out[0] = 0xf0 | (c >> 18);
+	out[1] = 0x80 | ((c >> 12) & 0x3f);
+	out[2] = 0x80 | ((c >> 6) & 0x3f);
+	out[3] = 0x80 | (c & 0x3f);
+	return 4;
+}
+
+// Appends UTF-8 encoding of @size letters to @ret
+template <typename L>
+static inline void encode(const L *letters, size_t size, std::string *ret) {
+	static_assert(sizeof(L) == sizeof(uint32_t), "letter must be 32-bit code point");
+
+	size_t start = ret->size();
+	ret->resize(start + size * 4);
+	char *out = &(*ret)[0] + start;
+	char *out_start = out;
+
+	size_t pos = 0;
+	while (pos < size) {
+#if defined(__SSE2__)
+		// 16 ASCII letters are narrowed with two saturating packs
+		const __m128i high = _mm_set1_epi32(~0x7f);
+		for (; pos + 16 <= size; pos += 16) {
+			const __m128i *src = (const __m128i *)(letters + pos);
+			__m128i a = _mm_loadu_si128(src + 0);
+			__m128i b = _mm_loadu_si128(src + 1);
+			__m128i c = _mm_loadu_si128(src + 2);
+			__m128i d = _mm_loadu_si128(src + 3);
+
+			__m128i any = _mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(any, high), _mm_setzero_si128())) != 0xffff)
+				break;
+
+			__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			_mm_storeu_si128((__m128i *)out, bytes);
+			out += 16;
+		}
+#endif
+		for (; pos < size; ++pos) {
+			uint32_t c = letters[pos].l;
+			if (c < 0x80) {
+				*out++ = c;
+				continue;
+			}
+
+			out += encode_one(c, out);
+			++pos;
+			break;
+		}
+	}
+
+	ret->resize(start + (out - out_start));
+}
+
+template <typename L>
+static inline std::string to_string(const L *letters, size_t size) {
+	std::string ret;
+	encode(letters, size, &ret);
+	return ret;
+}
+
+template <typename S>
+static inline std::string to_string(const S &ls) {
+	return to_string(ls.data(), ls.size());
+}
+
+}}} // namespace ioremap::warp::utf8
+
+#endif /* __WARP_UTF8_HPP */
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_XOR_FILTER_HPP
+#define __WARP_XOR_FILTER_HPP
+
+#include <ribosome/error.hpp>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace ioremap { namespace warp {
+
+/*
+ * Static xor filter which maps a word to 8-bit value, it is used to store
+ * bitmask of languages whose dictionaries contain given word.
+ *
+ * Every 32-bit cell holds 24-bit fingerprint and 8-bit value part, word is mapped
+ * to three cells (one in every third of the table) and xor of those cells equals
+ * to fingerprint and value of the word. Words which were not added return
+ * zero value except for about 2^-24 false positive probability, which is why
+ * positive answer must be confirmed by the dictionary itself.
+ */
+class word_filter {
+public:
+	static uint64_t hash(const char *data, size_t size) {
+		uint64_t h = 14695981039346656037ULL;
+		for (size_t i = 0; i < size; ++i) {
+			h ^= (unsigned char)data[i];
+			h *= 1099511628211ULL;
+		}
+
+		return h;
+	}
+
+	static uint64_t hash(const std::string &word) {
+		return hash(word.data(), word.size());
+	}
+
+	// @keys are pairs of word hash and value, values of the same hash are or'ed,
+	// filter is left empty if it could not be built within @max_attempts seeds
+	ribosome::error_info build(std::vector<std::pair<uint64_t, uint8_t>> &keys, int max_attempts = 100) {
+		clear();
+
+		std::sort(keys.begin(), keys.end());
+
+		std::vector<uint64_t> hashes;
+		std::vector<uint8_t> values;
+		for (const auto &k: keys) {
+			if (hashes.size() && hashes.back() == k.first) {
+				values.back() |= k.second;
+				continue;
+			}
+
+			hashes.push_back(k.first);
+			values.push_back(k.second);
+		}
+
+		if (hashes.empty())
+			return ribosome::error_info();
+
+		size_t capacity = 32 + 1.23 * hashes.size();
+		size_t block = capacity / 3 + 1;
+
+		std::vector<uint32_t> cells(block * 3);
+		std::vector<uint32_t> counts(block * 3);
+		std::vector<uint32_t> key_xor(block * 3);
+		std::vector<uint32_t> queue;
+		std::vector<std::pair<uint32_t, uint32_t>> stack;
+
+		uint64_t seed = 0x726f636b73646221ULL;
+		for (int attempt = 0; attempt < max_attempts; ++attempt, seed = mix(seed)) {
+			std::fill(counts.begin(), counts.end(), 0);
+			std::fill(key_xor.begin(), key_xor.end(), 0);
+			queue.clear();
+			stack.clear();
+
+			for (uint32_t i = 0; i < hashes.size(); ++i) {
+				size_t pos[3];
+				slots(mix(hashes[i] + seed), block, pos);
+				for (int j = 0; j < 3; ++j) {
+					counts[pos[j]]++;
+					key_xor[pos[j]] ^= i;
+				}
+			}
+
+			for (uint32_t slot = 0; slot < counts.size(); ++slot) {
+				if (counts[slot] == 1)
+					queue.push_back(slot);
+			}
+
+			// peel cells with single key, that key is assigned to the cell
+			while (!queue.empty()) {
+				uint32_t slot = queue.back();
+				queue.pop_back();
+				if (counts[slot] != 1)
+					continue;
+
+				uint32_t idx = key_xor[slot];
+				stack.emplace_back(idx, slot);
+
+				size_t pos[3];
+				slots(mix(hashes[idx] + seed), block, pos);
+				for (int j = 0; j < 3; ++j) {
+					counts[pos[j]]--;
+					key_xor[pos[j]] ^= idx;
+					if (counts[pos[j]] == 1)
+						queue.push_back(pos[j]);
+				}
+			}
+
+			if (stack.size() != hashes.size())
+				continue;
+
+			std::fill(cells.begin(), cells.end(), 0);
+			for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+				uint64_t h = mix(hashes[it->first] + seed);
+
+				size_t pos[3];
+				slots(h, block, pos);
+
+				uint32_t cell = (fingerprint(h) << 8) | values[it->first];
+				for (int j = 0; j < 3; ++j) {
+					if (pos[j] != it->second)
+						cell ^= cells[pos[j]];
+				}
+
+				cells[it->second] = cell;
+			}
+
+			m_cells.swap(cells);
+			m_block = block;
+			m_seed = seed;
+			m_size = hashes.size();
+			return ribosome::error_info();
+		}
+
+		return ribosome::create_error(-EINVAL, "could not build xor filter for %zd words", hashes.size());
+	}
+
+	// returns value of the word or 0 if word has not been added
+	uint8_t find(uint64_t word_hash) const {
+		if (m_cells.empty())
+			return 0;
+
+		uint64_t h = mix(word_hash + m_seed);
+
+		size_t pos[3];
+		slots(h, m_block, pos);
+
+		uint32_t cell = m_cells[pos[0]] ^ m_cells[pos[1]] ^ m_cells[pos[2]];
+		if ((cell >> 8) != fingerprint(h))
+			return 0;
+
+		return cell & 0xff;
+	}
+
+	uint8_t find(const std::string &word) const {
+		return find(hash(word));
+	}
+
+	bool empty() const {
+		return m_cells.empty();
+	}
+
+	size_t size() const {
+		return m_size;
+	}
+
+	void clear() {
+		m_cells.clear();
+		m_block = 0;
+		m_seed = 0;
+		m_size = 0;
+	}
+
+private:
+	std::vector<uint32_t> m_cells;
+	size_t m_block = 0;
+	uint64_t m_seed = 0;
+	size_t m_size = 0;
+
+	static uint64_t mix(uint64_t h) {
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return h;
+	}
+
+	static uint32_t fingerprint(uint64_t h) {
+		return (h ^ (h >> 32)) & 0xffffff;
+	}
+
+	static uint32_t reduce(uint32_t h, size_t n) {
+		return ((uint64_t)h * n) >> 32;
+	}
+
+	static void slots(uint64_t h, size_t block, size_t *pos) {
+		pos[0] = reduce(h, block);
+		pos[1] = block + reduce((h << 21) | (h >> 43), block);
+		pos[2] = 2 * block + reduce((h << 42) | (h >> 22), block);
+	}
+};
+
+}} // namespace ioremap::warp
+
+#endif /* __WARP_XOR_FILTER_HPP */
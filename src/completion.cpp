@@ -0,0 +1,93 @@
+#include "warp/completion.hpp"
+#include "warp/database.hpp"
+#include "warp/normalizer.hpp"
+
+#include <boost/program_options.hpp>
+
+#include <ribosome/timer.hpp>
+
+#include <iostream>
+
+using namespace ioremap;
+
+int main(int argc, char *argv[])
+{
+	namespace bpo = boost::program_options;
+
+	bpo::options_description generic("Completion index builder options");
+
+	std::string rocksdb_path, output;
+	size_t top_k;
+	int boundary;
+	bool fold = false;
+	generic.add_options()
+		("help", "This help message")
+		("rocksdb", bpo::value<std::string>(&rocksdb_path)->required(), "Input rocksdb language model")
+		("output", bpo::value<std::string>(&output)->required(), "Output completion index file")
+		("top", bpo::value<size_t>(&top_k)->default_value(10), "Number of most frequent completions stored per prefix")
+		("boundary", bpo::value<int>(&boundary)->default_value(0), "Skip word forms which have less than this frequency")
+		("fold", "Fold word forms (ё -> е, punctuation) like the server does for requests with 'fold' option")
+		;
+
+	bpo::options_description cmdline_options;
+	cmdline_options.add(generic);
+
+	try {
+		bpo::variables_map vm;
+		bpo::store(bpo::command_line_parser(argc, argv).options(cmdline_options).run(), vm);
+
+		if (vm.count("help")) {
+			std::cout << generic << std::endl;
+			return 0;
+		}
+
+		fold = vm.count("fold") != 0;
+
+		bpo::notify(vm);
+	} catch (const std::exception &e) {
+		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
+		return -1;
+	}
+
+	warp::dictionary::database db;
+	auto err = db.open_read_only(rocksdb_path);
+	if (err) {
+		std::cerr << "Could not open database: " << err.message() << std::endl;
+		return err.code();
+	}
+
+	ribosome::timer tm;
+	warp::completion::builder builder(top_k);
+	warp::normalizer norm("", fold ? warp::normalizer::fold_text : 0);
+	long words = 0;
+
+	err = db.iterate(db.options().word_form_prefix, [&] (const rocksdb::Slice &key, const rocksdb::Slice &value) -> bool {
+		warp::dictionary::word_form wf;
+		auto err = warp::deserialize(wf, value.data(), value.size());
+		if (err) {
+			std::cerr << "Could not deserialize word form, key: " << key.ToString() <<
+				", error: " << err.message() << std::endl;
+			return true;
+		}
+
+		if (wf.freq >= boundary) {
+			builder.add(fold ? norm.normalize(wf.word.data(), wf.word.size()) : wf.word, wf.freq);
+			words++;
+		}
+
+		return true;
+	});
+	if (err) {
+		std::cerr << "Could not read word forms: " << err.message() << std::endl;
+		return err.code();
+	}
+
+	err = builder.write(output);
+	if (err) {
+		std::cerr << "Could not write completion index: " << err.message() << std::endl;
+		return err.code();
+	}
+
+	printf("%s: %ld word forms, %.2f seconds\n", output.c_str(), words, tm.elapsed() / 1000.0);
+	return 0;
+}
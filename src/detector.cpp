@@ -1,16 +1,21 @@
 #include "warp/alphabet.hpp"
 #include "warp/ngram.hpp"
+#include "warp/tokenizer.hpp"
+#include "warp/utf8.hpp"
 
 #include <ribosome/dir.hpp>
 #include <ribosome/html.hpp>
 #include <ribosome/lstring.hpp>
-#include <ribosome/split.hpp>
+#include <ribosome/timer.hpp>
 
 #include <boost/program_options.hpp>
 
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <thread>
 
 using namespace ioremap;
 
@@ -22,19 +27,24 @@ int main(int argc, char *argv[])
 	std::vector<std::string> check;
 	std::vector<std::string> astrings;
 
-	std::string save_path, load_path;
+	std::string save_path, load_path, compile_path;
+	int threads;
 
 	bpo::options_description generic("Language detector test options");
 	generic.add_options()
 		("help", "this help message")
 		("save", bpo::value<std::string>(&save_path), "save language statistics into given file")
 		("load", bpo::value<std::string>(&load_path), "load language statistics from given file")
+		("compile", bpo::value<std::string>(&compile_path),
+			"write compiled mmap-able detector model into given file, it can only be used for detection")
 		("alphabet", bpo::value<std::vector<std::string>>(&astrings)->composing(),
 			 "for any given language use only provided alphabet, for example: english:abcdefghijklmnopqrstuvwxyz")
 		("learn", bpo::value<std::vector<std::string>>(&learn)->composing(),
 		 	"files to learn language, format: --learn language:directory")
 		("check", bpo::value<std::vector<std::string>>(&check)->composing(),
 		 	"files to check language")
+		("threads", bpo::value<int>(&threads)->default_value(std::thread::hardware_concurrency()),
+			"number of learning threads")
 		;
 
 
@@ -87,6 +97,9 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	// files are collected first and then processed by learning threads,
+	// every thread has its own detector, they are merged when all files have been parsed
+	std::vector<std::pair<std::string, std::string>> files;
 	for (auto &l: learn) {
 		auto p = prepare_dir(l);
 		if (p.first.empty() || p.second.empty())
@@ -98,27 +111,103 @@ int main(int argc, char *argv[])
 		ribosome::iterate_directory(dir, [&](const char *path, const char *file) -> bool {
 			(void) file;
 
+			files.emplace_back(lang, path);
+			return true;
+		});
+	}
+
+	if (threads <= 0)
+		threads = 1;
+
+	std::vector<warp::detector<std::string, std::string>> thread_dets(threads);
+	std::atomic<size_t> next_file(0), files_done(0), bytes_done(0);
+
+	auto learn_thread = [&] (int idx) {
+		auto &tdet = thread_dets[idx];
+		warp::tokenizer tok(warp::drop_characters, warp::normalizer::fold_text);
+
+		while (true) {
+			size_t fidx = next_file++;
+			if (fidx >= files.size())
+				break;
+
+			const auto &lang = files[fidx].first;
+			const auto &path = files[fidx].second;
+
 			ribosome::html_parser html;
-			html.feed_file(path);
+			html.feed_file(path.c_str());
 			std::string text = html.text(" ");
-			std::string lower = ribosome::lconvert::string_to_lower(text);
-
-			ribosome::split spl;
-			auto all_words = spl.convert_split_words(lower.c_str(), lower.size(), warp::drop_characters);
+			tok.tokenize(text);
 
-			for (auto &lw: all_words) {
+			for (const auto &t: tok.tokens()) {
+				ribosome::lstring lw = warp::utf8::to_lstring(tok.data(t), t.norm_size);
 				if (alphabets.ok(lang, lw)) {
-					std::string word = ribosome::lconvert::to_string(lw);
-					det.load_text(word, lang);
+					tdet.load_text(tok.word(t), lang);
 				}
 			}
 
-			std::cout << "loaded " << text.size() << " bytes from " << path << ", language: " << lang << std::endl;
-			return true;
-		});
+			bytes_done += text.size();
+			files_done++;
+		}
+	};
+
+	if (files.size()) {
+		ribosome::timer tm;
+
+		std::vector<std::thread> pool;
+		for (int i = 0; i < threads; ++i) {
+			pool.emplace_back(learn_thread, i);
+		}
+
+		auto report = [&] () {
+			double seconds = tm.elapsed() / 1000.0;
+			double mb = bytes_done / 1024.0 / 1024.0;
+			printf("learning: files: %zd/%zd, text: %.2f MB, %.2f seconds, %.2f MB/s\n",
+					files_done.load(), files.size(), mb, seconds, seconds > 0 ? mb / seconds : 0.);
+			fflush(stdout);
+		};
+
+		while (files_done < files.size()) {
+			std::this_thread::sleep_for(std::chrono::seconds(1));
+			report();
+		}
+
+		for (auto &t: pool) {
+			t.join();
+		}
+
+		// pairwise merge of thread detectors, every round merges pairs in parallel
+		for (size_t step = 1; step < thread_dets.size(); step *= 2) {
+			std::vector<std::thread> mergers;
+			for (size_t i = 0; i + step < thread_dets.size(); i += step * 2) {
+				mergers.emplace_back([&, i, step] () {
+					thread_dets[i].merge(thread_dets[i + step]);
+					thread_dets[i + step] = warp::detector<std::string, std::string>();
+				});
+			}
+
+			for (auto &t: mergers) {
+				t.join();
+			}
+		}
+
+		det.merge(thread_dets[0]);
+		report();
+	}
+
+	if (det.has_stats()) {
+		det.sort();
 	}
 
-	det.sort();
+	if (compile_path.size()) {
+		int err = det.save_compiled_file(compile_path.c_str());
+		if (err) {
+			std::cerr << "Could not write compiled detector model into " << compile_path << ": " << err << std::endl;
+			return err;
+		}
+
+		std::cout << "Successfully wrote compiled detector model into " << compile_path << std::endl;
+	}
 
 	if (save_path.size()) {
 		int err = det.save_file(save_path.c_str());
@@ -130,7 +219,7 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	ribosome::split spl;
+	warp::tokenizer tok(warp::drop_characters, warp::normalizer::fold_text);
 	for (auto &c: check) {
 		auto p = prepare_dir(c);
 		if (p.first.empty() || p.second.empty())
@@ -144,25 +233,23 @@ int main(int argc, char *argv[])
 			ribosome::html_parser html;
 			html.feed_file(path);
 			std::string text = html.text(" ");
-			std::string lower = ribosome::lconvert::string_to_lower(text);
+			tok.tokenize(text);
 
 			long errors = 0;
 			long total = 0;
 
-			auto all_words = spl.convert_split_words(lower.data(), lower.size(), warp::drop_characters);
-			for (auto &w: all_words) {
-				std::string detected = det.detect(ribosome::lconvert::to_string(w));
+			for (const auto &t: tok.tokens()) {
+				std::string word = tok.word(t);
+				std::string detected = det.detect(word);
 
 				if (detected != lang) {
 					std::cout << "detection: file: " << path <<
-						", word: " << ribosome::lconvert::to_string(w) <<
-						", word: " << w <<
+						", word: " << word <<
 						", language: " << detected << std::endl;
 					errors++;
 				} else {
 					std::cout << "detection: file: " << path <<
-						", word: " << ribosome::lconvert::to_string(w) <<
-						", word: " << w <<
+						", word: " << word <<
 						", successfully detected language: " << detected << std::endl;
 				}
 
@@ -1,4 +1,5 @@
 #include "warp/fuzzy.hpp"
+#include "warp/utf8.hpp"
 
 #include <boost/program_options.hpp>
 
@@ -66,7 +67,7 @@ int main(int argc, char *argv[])
 
 		struct warp::check_control ctl;
 		ctl.word = t;
-		ctl.lw = ribosome::lconvert::from_utf8(ctl.word);
+		ctl.lw = warp::utf8::to_lstring(ctl.word);
 		ctl.lw = ribosome::lconvert::to_lower(ctl.lw);
 		ctl.level = level;
 		ctl.max_num = num;
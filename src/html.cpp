@@ -1,12 +1,13 @@
 #include "warp/alphabet.hpp"
 #include "warp/database.hpp"
 #include "warp/pack.hpp"
+#include "warp/tokenizer.hpp"
+#include "warp/utf8.hpp"
 
 #include <boost/program_options.hpp>
 
 #include <ribosome/lstring.hpp>
 #include <ribosome/html.hpp>
-#include <ribosome/split.hpp>
 #include <ribosome/timer.hpp>
 
 using namespace ioremap;
@@ -22,12 +23,12 @@ public:
 		m_html.feed_file(path);
 
 		std::string text = m_html.text(" ");
-		std::string lower = ribosome::lconvert::string_to_lower(text);
 
-		ribosome::split spl;
-		auto all_words = spl.convert_split_words(lower.c_str(), lower.size(), warp::drop_characters);
+		warp::tokenizer tok(warp::drop_characters, warp::normalizer::fold_text);
+		tok.tokenize(text);
 
-		for (auto &lw: all_words) {
+		for (const auto &t: tok.tokens()) {
+			ribosome::lstring lw = warp::utf8::to_lstring(tok.data(t), t.norm_size);
 			if (!m_alphabet.ok(lw)) {
 				continue;
 			}
@@ -36,7 +37,7 @@ public:
 			if (it == m_model.end()) {
 				warp::dictionary::word_form wf;
 				wf.lw = lw;
-				wf.word = ribosome::lconvert::to_string(lw);
+				wf.word = tok.word(t);
 				wf.freq = 1;
 				wf.documents = 1;
 				m_model.insert(std::make_pair<ribosome::lstring, warp::dictionary::word_form>(std::move(lw), std::move(wf)));
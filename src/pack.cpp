@@ -17,8 +17,10 @@
 #include "warp/database.hpp"
 #include "warp/feature.hpp"
 #include "warp/ngram.hpp"
+#include "warp/normalizer.hpp"
 #include "warp/pack.hpp"
 #include "warp/stem.hpp"
+#include "warp/utf8.hpp"
 #include "warp/utils.hpp"
 
 #include <boost/program_options.hpp>
@@ -33,6 +35,7 @@ int main(int argc, char *argv[])
 
 	std::string skip, pass;
 	std::string input, rocksdb_path;
+	bool fold = false;
 	generic.add_options()
 		("help", "This help message")
 		("input", bpo::value<std::string>(&input)->required(), "Input Zaliznyak dictionary file")
@@ -41,6 +44,7 @@ int main(int argc, char *argv[])
 		 	"Comma-separated features which will force word to be skipped from indexing if present")
 		("pass", bpo::value<std::string>(&pass),
 		 	"Comma-separated features which will force word to be skipped from indexing, if feature is not present")
+		("fold", "Fold word forms (ё -> е, punctuation) like the server does for requests with 'fold' option")
 		;
 
 	bpo::options_description cmdline_options;
@@ -55,6 +59,8 @@ int main(int argc, char *argv[])
 			return 0;
 		}
 
+		fold = vm.count("fold") != 0;
+
 		bpo::notify(vm);
 	} catch (const std::exception &e) {
 		std::cerr << "Invalid options: " << e.what() << "\n" << generic << std::endl;
@@ -71,6 +77,7 @@ int main(int argc, char *argv[])
 	}
 
 	warp::stemmer stem;
+	warp::normalizer norm("", fold ? warp::normalizer::fold_text : 0);
 
 	warp::zparser records([&] (struct warp::parsed_word &word) -> ribosome::error_info {
 		ribosome::error_info err;
@@ -78,8 +85,13 @@ int main(int argc, char *argv[])
 			return err;
 
 		warp::dictionary::word_form wf;
-		wf.word = ribosome::lconvert::to_string(word.lemma);
-		wf.lw = word.lemma;
+		wf.word = warp::utf8::to_string(word.lemma);
+		if (fold) {
+			wf.word = norm.normalize(wf.word.data(), wf.word.size());
+			if (wf.word.empty())
+				return err;
+		}
+		wf.lw = warp::utf8::to_lstring(wf.word);
 		wf.freq = word.features.size();
 		wf.documents = 1;
 		wf.indexed_id = db.metadata().get_sequence();
@@ -14,12 +14,19 @@
  * limitations under the License.
  */
 
+#include "warp/batch.hpp"
 #include "warp/error_check.hpp"
 #include "warp/json.hpp"
 #include "warp/jsonvalue.hpp"
+#include "warp/html_stream.hpp"
 #include "warp/language_model.hpp"
+#include "warp/message.hpp"
+#include "warp/normalizer.hpp"
 #include "warp/stem.hpp"
 #include "warp/thevoid_stream.hpp"
+#include "warp/thread_pool.hpp"
+#include "warp/tokenizer.hpp"
+#include "warp/utf8.hpp"
 
 #include <swarm/logger.hpp>
 
@@ -28,9 +35,10 @@
 #include <ribosome/error.hpp>
 #include <ribosome/html.hpp>
 #include <ribosome/lstring.hpp>
-#include <ribosome/split.hpp>
 
-#include <boost/algorithm/string/trim_all.hpp>
+#include <atomic>
+#include <memory>
+#include <thread>
 
 #define WLOG(level, a...) BH_LOG(logger(), level, ##a)
 #define WLOG_ERROR(a...) WLOG(SWARM_LOG_ERROR, ##a)
@@ -44,10 +52,8 @@ using namespace ioremap;
 static std::string clear_symbols = "~`1234567890-=!@#$%^&*()_+[]\\{}|';\":/.,?><\n\r\t ";
 static std::string clear_symbols_without_numbers = "~`-=!@#$%^&*()_+[]\\{}|';\":/.,?><\n\r\t ";
 
-static std::string clear_text(const std::string &text)
-{
-	return boost::algorithm::trim_fill_copy_if(text, " ", boost::is_any_of(clear_symbols));
-};
+// lowercases text and replaces every run of clear_symbols with single space
+static const warp::normalizer clear_text_normalizer(clear_symbols, warp::normalizer::fold_text);
 
 class http_server : public thevoid::server<http_server>
 {
@@ -57,6 +63,17 @@ public:
 			return false;
 		}
 
+		// optional cache of whole /tokenize, /convert and /error_check replies
+		const auto &rc = warp::get_object(config, "response_cache");
+		if (rc.IsObject()) {
+			m_cache.reset(new warp::response_cache(warp::get_int64(rc, "size", 256 * 1024 * 1024),
+					warp::get_int64(rc, "ttl", 600)));
+		}
+
+		// batch documents are processed outside of the network threads
+		size_t compute_threads = warp::get_int64(config, "compute_threads", std::thread::hardware_concurrency());
+		m_compute.reset(new warp::thread_pool(compute_threads));
+
 		on<on_lang>(
 			options::exact_match("/tokenize"),
 			options::methods("POST")
@@ -66,6 +83,10 @@ public:
 			options::methods("POST")
 		);
 
+		on<on_tokenize_stream>(
+			options::prefix_match("/tokenize/"),
+			options::methods("POST")
+		);
 		on<on_add_language>(
 			options::prefix_match("/add_language/"),
 			options::methods("POST")
@@ -76,11 +97,38 @@ public:
 			options::methods("POST")
 		);
 
+		on<on_batch>(
+			options::exact_match("/batch"),
+			options::methods("POST")
+		);
+
+		on<on_complete>(
+			options::exact_match("/complete"),
+			options::methods("GET")
+		);
+
+		on<on_metrics>(
+			options::exact_match("/metrics"),
+			options::methods("GET")
+		);
+
 		return true;
 	}
 
-	struct on_add_language : public thevoid::simple_request_stream_error<http_server> {
-		virtual void on_request(const thevoid::http_request &http_req, const boost::asio::const_buffer &buffer) {
+	/*
+	 * Request body is processed chunk by chunk as it arrives: HTML is stripped incrementally and the text
+	 * is cut at word boundaries, so only one chunk and an unfinished word are kept in memory.
+	 */
+	static const size_t body_chunk_size = 1024 * 1024;
+
+	// unfinished word kept between body chunks is cut when it grows above this size
+	static const size_t max_word_size = 4096;
+
+	// POST /add_language/<language>, body is HTML document, it is learnt in body_chunk_size pieces
+	struct on_add_language : public thevoid::buffered_request_stream_error<http_server> {
+		virtual void on_request(const thevoid::http_request &http_req) {
+			stats().endpoint = "add_language";
+
 			const auto &pc = http_req.url().path_components();
 			if (pc.size() != 2) {
 				send_error(swarm::http_response::bad_request, -EINVAL,
@@ -88,30 +136,339 @@ public:
 							pc.size(), http_req.url().path().c_str());
 				return;
 			}
-			const std::string &lang = pc[1];
+			m_lang = pc[1];
+			stats().language = m_lang;
 
+			set_chunk_size(body_chunk_size);
+			try_next_chunk();
+		}
+
+		virtual void on_chunk(const boost::asio::const_buffer &buffer, unsigned int flags) {
 			const char *ptr = boost::asio::buffer_cast<const char*>(buffer);
-			if (!ptr) {
+			size_t size = boost::asio::buffer_size(buffer);
+			bool last = flags & last_chunk;
+
+			if (ptr && size) {
+				m_html.feed(ptr, size, &m_text);
+				m_received += size;
+				stats().bytes_in += size;
+			}
+			if (last) {
+				m_html.finish(&m_text);
+			}
+
+			// unfinished word at the end of the chunk waits for the next one
+			size_t complete = last ? m_text.size() :
+				m_tokenizer.complete_prefix(m_text.data(), m_text.size(), max_word_size);
+			std::string clear_request = clear_text_normalizer.normalize(m_text.data(), complete);
+			m_text.erase(0, complete);
+
+			if (clear_request.size()) {
+				auto err = server()->detector_save(clear_request, m_lang);
+				if (err) {
+					send_error(swarm::http_response::internal_server_error, err.code(),
+							"could not save statistics data: %s", err.message().c_str());
+					return;
+				}
+			}
+
+			if (!last) {
+				try_next_chunk();
+				return;
+			}
+
+			if (m_received == 0) {
 				send_error(swarm::http_response::bad_request, -EINVAL, "document is empty");
 				return;
 			}
+
+			send_empty_reply(swarm::http_response::ok);
+		}
+
+		virtual void on_error(const boost::system::error_code &err) {
+			WLOG_ERROR("add_language: %s: could not receive document: %s", m_lang.c_str(), err.message().c_str());
+		}
+
+	private:
+		std::string m_lang;
+		size_t m_received = 0;
+
+		warp::html_stripper m_html;
+		std::string m_text;
+		warp::tokenizer m_tokenizer{clear_symbols, warp::normalizer::fold_text};
+	};
+
+	/*
+	 * POST /tokenize/<name>[?stem][&fold], body is HTML document which is tokenized while it is received,
+	 * reply is the same as /tokenize reply for {"request": {"<name>": document}}.
+	 * Document language is detected using the first document_prefix_size bytes of normalized text.
+	 */
+	struct on_tokenize_stream : public thevoid::buffered_request_stream_error<http_server> {
+		static const size_t document_prefix_size = 64 * 1024;
+
+		virtual void on_request(const thevoid::http_request &http_req) {
+			stats().endpoint = "tokenize_stream";
+
+			const auto &pc = http_req.url().path_components();
+			if (pc.size() != 2) {
+				send_error(swarm::http_response::bad_request, -EINVAL,
+						"there are %ld path components in %s, must be 2",
+							pc.size(), http_req.url().path().c_str());
+				return;
+			}
+
+			m_name = pc[1];
+			m_want_stemming = http_req.url().query().has_item("stem");
+			if (http_req.url().query().has_item("fold"))
+				m_tokenizer = warp::tokenizer(clear_symbols_without_numbers, warp::normalizer::fold_text);
+			m_pretty = http_req.url().query().has_item("pretty");
+			m_msgpack = warp::reply_writer::want_msgpack(http_req, false);
+
+			set_chunk_size(body_chunk_size);
+			try_next_chunk();
+		}
+
+		virtual void on_chunk(const boost::asio::const_buffer &buffer, unsigned int flags) {
+			const char *ptr = boost::asio::buffer_cast<const char*>(buffer);
 			size_t size = boost::asio::buffer_size(buffer);
+			bool last = flags & last_chunk;
 
-			ribosome::html_parser html;
-			html.feed_text(ptr, size);
+			if (ptr && size) {
+				m_html.feed(ptr, size, &m_text);
+				stats().bytes_in += size;
+			}
+			if (last) {
+				m_html.finish(&m_text);
+			}
 
-			std::string nohtml_request = html.text(" ");
-			auto lower_request = ribosome::lconvert::string_to_lower(nohtml_request);
-			std::string clear_request = clear_text(lower_request);
+			size_t complete = last ? m_text.size() :
+				m_tokenizer.complete_prefix(m_text.data(), m_text.size(), max_word_size);
+			m_tokenizer.tokenize(m_text.data(), complete);
+			m_text.erase(0, complete);
+
+			for (const auto &t: m_tokenizer.tokens()) {
+				m_words[m_tokenizer.word(t)].push_back(m_position++);
+			}
+			stats().tokens += m_tokenizer.tokens().size();
+
+			if (m_prefix.size() < document_prefix_size && m_tokenizer.normalized().size()) {
+				if (m_prefix.size())
+					m_prefix.push_back(' ');
+				m_prefix.append(m_tokenizer.normalized(), 0, document_prefix_size - m_prefix.size());
+				m_prefix.resize(warp::utf8::boundary(m_prefix.data(), m_prefix.size()));
+			}
+
+			if (!last) {
+				try_next_chunk();
+				return;
+			}
+
+			std::string doc_lang = server()->detect_document(m_prefix);
+			stats().language = doc_lang;
+
+			std::string reply_data;
+			warp::reply_writer writer(reply_data, m_msgpack, m_pretty);
+
+			writer.StartObject(1);
+			writer.String(m_name);
+			writer.StartObject(2);
+			writer.String("language").String(doc_lang);
+			server()->write_tokens(writer, m_words, doc_lang, m_want_stemming);
+			writer.EndObject();
+			writer.EndObject();
+			writer.finish();
+
+			send_reply_body(swarm::http_response::ok, writer.content_type(), std::move(reply_data));
+		}
+
+		virtual void on_error(const boost::system::error_code &err) {
+			WLOG_ERROR("tokenize: %s: could not receive document: %s", m_name.c_str(), err.message().c_str());
+		}
+
+	private:
+		std::string m_name;
+		bool m_want_stemming = false;
+		bool m_pretty = false;
+		bool m_msgpack = false;
+
+		warp::html_stripper m_html;
+		std::string m_text;
+		warp::tokenizer m_tokenizer{clear_symbols_without_numbers};
+
+		std::string m_prefix;
+		std::map<std::string, std::vector<size_t>> m_words;
+		size_t m_position = 0;
+	};
+
+	// GET /complete?q=prefix[&lang=russian][&max_num=10][&fold]
+	struct on_complete : public thevoid::simple_request_stream_error<http_server> {
+		virtual void on_request(const thevoid::http_request &http_req, const boost::asio::const_buffer &buffer) {
+			(void) buffer;
 
-			auto err = server()->detector_save(clear_request, lang);
+			stats().endpoint = "complete";
+
+			const auto &query = http_req.url().query();
+
+			auto q = query.item_value("q");
+			if (!q || q->empty()) {
+				send_error(swarm::http_response::bad_request, -EINVAL, "'q' query parameter must be a non-empty prefix");
+				return;
+			}
+
+			std::string lang;
+			auto lang_item = query.item_value("lang");
+			if (lang_item)
+				lang = *lang_item;
+			stats().language = lang;
+
+			size_t max_num = 10;
+			auto max_num_item = query.item_value("max_num");
+			if (max_num_item) {
+				max_num = strtoul(max_num_item->c_str(), NULL, 0);
+			}
+
+			// prefix is normalized like words of the other endpoints, ?fold must match folding of the index
+			warp::normalizer norm("", query.has_item("fold") ? warp::normalizer::fold_text : 0);
+			std::string prefix = norm.normalize(q->data(), q->size());
+			if (prefix.empty()) {
+				send_error(swarm::http_response::bad_request, -EINVAL, "prefix '%s' has no letters", q->c_str());
+				return;
+			}
+
+			std::vector<warp::completion_result> completions;
+			auto err = server()->complete(lang, prefix, max_num, &completions);
 			if (err) {
-				send_error(swarm::http_response::internal_server_error, err.code(),
-						"could not save statistics data: %s", err.message().c_str());
+				send_error(swarm::http_response::bad_request, err.code(),
+						"could not complete prefix '%s': %s", q->c_str(), err.message().c_str());
 				return;
 			}
 
-			this->send_reply(swarm::http_response::ok);
+			std::string reply_data;
+			warp::reply_writer writer(reply_data, warp::reply_writer::want_msgpack(http_req, false),
+					query.has_item("pretty"));
+
+			writer.StartObject(1);
+			writer.String("completions");
+			writer.StartArray(completions.size());
+			for (const auto &c: completions) {
+				writer.StartObject(3);
+				writer.String("word").String(c.form.word, c.form.size);
+				writer.String("freq").Int(c.form.freq);
+				writer.String("language").String(c.language);
+				writer.EndObject();
+			}
+			writer.EndArray();
+			writer.EndObject();
+			writer.finish();
+
+			send_reply_body(swarm::http_response::ok, writer.content_type(), std::move(reply_data));
+		}
+	};
+
+	// GET /metrics, request counters and latency histograms in Prometheus text format
+	struct on_metrics : public thevoid::simple_request_stream_error<http_server> {
+		virtual void on_request(const thevoid::http_request &http_req, const boost::asio::const_buffer &buffer) {
+			(void) http_req;
+			(void) buffer;
+
+			stats().endpoint = "metrics";
+
+			std::string reply_data = server()->metrics().prometheus();
+			if (server()->cache())
+				server()->cache()->prometheus(&reply_data);
+
+			send_reply_body(swarm::http_response::ok, "text/plain; version=0.0.4", std::move(reply_data));
+		}
+	};
+
+	/*
+	 * Writes {["urls",] "language", "tokens"} object for /tokenize or {["urls",] "language", "text"[, "stem"]}
+	 * object for /convert of one HTML document.
+	 */
+	class document_processor {
+	public:
+		// @fold enables normalizer::fold_text for words, otherwise only case is changed
+		document_processor(http_server *server, bool tokenize, bool want_stemming, bool want_urls, bool fold) :
+			m_server(server), m_tokenize(tokenize), m_want_stemming(want_stemming), m_want_urls(want_urls),
+			m_tokenizer(clear_symbols_without_numbers, fold ? warp::normalizer::fold_text : 0) {
+		}
+
+		void write(warp::reply_writer &writer, const char *text, size_t size) {
+			writer.StartObject(m_want_urls + 1 + (m_tokenize ? 1 : 1 + m_want_stemming));
+
+			ribosome::html_parser html;
+			html.feed_text(text, size);
+
+			if (m_want_urls) {
+				writer.String("urls");
+				writer.StartArray(html.urls().size());
+				for (const auto &url: html.urls()) {
+					writer.String(url);
+				}
+				writer.EndArray();
+			}
+
+			std::string nohtml_request = html.text(" ");
+			m_tokenizer.tokenize(nohtml_request);
+
+			// language of the whole document is a prior for every word
+			std::string doc_lang = m_server->detect_document(m_tokenizer.normalized());
+			writer.String("language").String(doc_lang);
+			m_language = doc_lang;
+
+			if (m_tokenize) {
+				tokenize(writer, doc_lang);
+			} else {
+				convert(writer, doc_lang);
+			}
+
+			writer.EndObject();
+		}
+
+		// language and number of words of the last written document
+		const std::string &language() const {
+			return m_language;
+		}
+		size_t tokens() const {
+			return m_tokenizer.tokens().size();
+		}
+
+	private:
+		http_server *m_server;
+		bool m_tokenize;
+		bool m_want_stemming;
+		bool m_want_urls;
+
+		warp::tokenizer m_tokenizer;
+		std::string m_language;
+
+		void tokenize(warp::reply_writer &writer, const std::string &doc_lang) {
+			std::map<std::string, std::vector<size_t>> words;
+			const auto &all_tokens = m_tokenizer.tokens();
+			for (size_t pos = 0; pos < all_tokens.size(); ++pos) {
+				words[m_tokenizer.word(all_tokens[pos])].push_back(pos);
+			}
+
+			m_server->write_tokens(writer, words, doc_lang, m_want_stemming);
+		}
+
+		void convert(warp::reply_writer &writer, const std::string &doc_lang) {
+			// normalized buffer already is lowercased words joined with single space
+			writer.String("text").String(m_tokenizer.normalized());
+
+			if (m_want_stemming) {
+				std::string stems;
+				for (const auto &t: m_tokenizer.tokens()) {
+					std::string word = m_tokenizer.word(t);
+					std::string lang = m_server->language(word, doc_lang);
+
+					if (stems.size())
+						stems.push_back(' ');
+					stems += m_server->stemmer().stem(word, lang, "");
+				}
+
+				writer.String("stem").String(stems);
+			}
 		}
 	};
 
@@ -126,181 +483,287 @@ public:
 			if (http_req.url().path().find("/tokenize") == 0) {
 				m_tokenize = true;
 			}
+			if (http_req.url().query().has_item("fold")) {
+				m_fold = true;
+			}
+			stats().endpoint = m_tokenize ? "tokenize" : "convert";
+			stats().bytes_in = boost::asio::buffer_size(buffer);
 
-			rapidjson::Document doc;
 			const char *ptr = boost::asio::buffer_cast<const char*>(buffer);
 			if (!ptr) {
 				send_error(swarm::http_response::bad_request, -EINVAL, "document is empty");
 				return;
 			}
 
-			std::string buf;
-			buf.assign(ptr, boost::asio::buffer_size(buffer));
-
-			doc.Parse<0>(buf.c_str());
-			if (doc.HasParseError()) {
-				send_error(swarm::http_response::bad_request, -EINVAL, "document parsing error: %s, offset: %ld",
-						doc.GetParseError(), doc.GetErrorOffset());
-				return;
+			bool stream = http_req.url().query().has_item("stream");
+			bool pretty = http_req.url().query().has_item("pretty");
+			if (!stream) {
+				bool request_msgpack = warp::is_msgpack(http_req.headers().content_type());
+
+				std::string options;
+				options.push_back('0' + m_want_stemming);
+				options.push_back('0' + m_want_urls);
+				options.push_back('0' + m_fold);
+				options.push_back('0' + pretty);
+				options.push_back('0' + request_msgpack);
+				options.push_back('0' + warp::reply_writer::want_msgpack(http_req, request_msgpack));
+
+				if (send_cached_reply(stats().endpoint.c_str(), options, ptr, boost::asio::buffer_size(buffer)))
+					return;
 			}
 
-			warp::JsonValue reply;
-			auto &alloc = reply.GetAllocator();
-
-			const auto &req = warp::get_object(doc, "request");
-			if (!req.IsObject()) {
-				send_error(swarm::http_response::bad_request, -ENOENT, "'request' must be object");
+			auto err = m_body.parse(http_req, ptr, boost::asio::buffer_size(buffer));
+			if (err) {
+				send_error(swarm::http_response::bad_request, err.code(), "%s", err.message().c_str());
 				return;
 			}
 
-			for (auto member_it = req.MemberBegin(), member_end = req.MemberEnd();
-					member_it != member_end; ++member_it) {
-				if (!member_it->value.IsString()) {
-					continue;
-				}
-
-				rapidjson::Value member(rapidjson::kObjectType);
+			m_processor.reset(new document_processor(server(), m_tokenize, m_want_stemming, m_want_urls, m_fold));
 
-				ribosome::html_parser html;
-				html.feed_text(member_it->value.GetString());
+			bool msgpack = warp::reply_writer::want_msgpack(http_req, m_body.msgpack());
 
-				if (m_want_urls) {
-					rapidjson::Value uarray(rapidjson::kArrayType);
-					for (const auto &url: html.urls()) {
-						rapidjson::Value uv(url.c_str(), url.size(), alloc);
-						uarray.PushBack(uv, alloc);
-					}
-
-					member.AddMember("urls", uarray, alloc);
-				}
-
-				std::string nohtml_request = html.text(" ");
-				ribosome::lstring lt = ribosome::lconvert::from_utf8(nohtml_request);
-				auto lower_request = ribosome::lconvert::to_lower(lt);
-
-				ribosome::split spl;
-				auto all_words = spl.convert_split_words(lower_request, clear_symbols_without_numbers);
-
-				if (m_tokenize) {
-					tokenize(member, alloc, all_words);
-				} else {
-					convert(member, alloc, all_words);
-				}
+			// ?stream: every member is sent as separate {"name": {...}} record as soon as it is ready
+			if (stream) {
+				send_records(warp::record_content_type(msgpack), [this, msgpack] (std::string *record) -> bool {
+							if (m_next_member == m_body.members().size())
+								return false;
 
-				// we can not use AddMember(member_it->name, member, alloc) here,
-				// since member_it->name is const_iterator and for some weird reason
-				// AddMember() only accepts reference to non-const object, although
-				// it is not modified internally.
-				reply.AddMember(member_it->name.GetString(), alloc, member, alloc);
+							warp::reply_writer writer(*record, msgpack);
+							writer.StartObject(1);
+							write_member(writer, m_body.members()[m_next_member++]);
+							writer.EndObject();
+							writer.finish();
+							return true;
+						});
+				return;
 			}
 
-			std::string reply_data = reply.ToString();
+			// members are written into reply as soon as they are processed, there is no reply DOM
+			std::string reply_data;
+			warp::reply_writer writer(reply_data, msgpack, pretty);
 
-			thevoid::http_response http_reply;
-			http_reply.set_code(swarm::http_response::ok);
-			http_reply.headers().set_content_length(reply_data.size());
-			http_reply.headers().set_content_type("text/json");
+			writer.StartObject(m_body.members().size());
+			for (const auto &member: m_body.members()) {
+				write_member(writer, member);
+			}
+			writer.EndObject();
+			writer.finish();
 
-			this->send_reply(std::move(http_reply), std::move(reply_data));
+			send_cacheable_reply(writer.content_type(), std::move(reply_data));
 		}
 
 	private:
 		bool m_tokenize = false;
 		bool m_want_stemming = false;
 		bool m_want_urls = false;
+		bool m_fold = false;
 
-		void tokenize(rapidjson::Value &member, rapidjson::Document::AllocatorType &alloc,
-				const std::vector<ribosome::lstring> &all_words) {
-			rapidjson::Value tokens(rapidjson::kArrayType);
+		warp::request_body m_body;
+		size_t m_next_member = 0;
 
-			std::map<std::string, std::vector<size_t>> words;
-			size_t pos = 0;
-			for (auto &w: all_words) {
-				auto word = ribosome::lconvert::to_string(w);
-				auto it = words.find(word);
-				if (it == words.end()) {
-					words[word] = std::vector<size_t>({pos});
-				} else {
-					it->second.push_back(pos);
-				}
+		std::unique_ptr<document_processor> m_processor;
 
-				++pos;
-			}
+		void write_member(warp::reply_writer &writer, const warp::request_member &member) {
+			writer.String(member.name, member.name_size);
+			m_processor->write(writer, member.value, member.value_size);
 
-			for (auto &p: words) {
-				const auto &word = p.first;
-				const auto &positions = p.second;
+			// multi-member requests are accounted under the language of their first member
+			if (stats().language.empty())
+				stats().language = m_processor->language();
+			stats().tokens += m_processor->tokens();
+		}
+	};
 
-				std::string lang = server()->language(word);
+	/*
+	 * POST /batch, body is {"documents": [{"text": "...", "operations": ["tokenize", "convert", "error_check"],
+	 * "stem": bool, "urls": bool, "fold": bool, "level": int, "max_num": int}, ...]}, only "text" is required and
+	 * the default operation is "tokenize".
+	 *
+	 * Documents are processed in parallel on the compute pool, reply is {"documents": [{"<operation>": result, ...}]}
+	 * in request order, every result is the same as for the single document endpoint.
+	 * Document which could not be processed is {"error": {"message", "code"}}, the rest of the batch is not affected.
+	 */
+	struct on_batch : public thevoid::simple_request_stream_error<http_server> {
+		virtual void on_request(const thevoid::http_request &http_req, const boost::asio::const_buffer &buffer) {
+			stats().endpoint = "batch";
+			stats().bytes_in = boost::asio::buffer_size(buffer);
 
-				rapidjson::Value lv(lang.c_str(), lang.size(), alloc);
-				rapidjson::Value wv(word.c_str(), word.size(), alloc);
+			const char *ptr = boost::asio::buffer_cast<const char*>(buffer);
+			if (!ptr) {
+				send_error(swarm::http_response::bad_request, -EINVAL, "document is empty");
+				return;
+			}
 
-				rapidjson::Value tok(rapidjson::kObjectType);
-				tok.AddMember("word", wv, alloc);
-				tok.AddMember("language", lv, alloc);
+			if (warp::is_msgpack(http_req.headers().content_type())) {
+				send_error(swarm::http_response::bad_request, -EINVAL, "batch request must be JSON");
+				return;
+			}
 
-				rapidjson::Value pv(rapidjson::kArrayType);
-				for (auto pos: positions) {
-					pv.PushBack(pos, alloc);
-				}
-				tok.AddMember("positions", pv, alloc);
+			auto err = m_batch.parse(ptr, boost::asio::buffer_size(buffer));
+			if (err) {
+				send_error(swarm::http_response::bad_request, err.code(), "%s", err.message().c_str());
+				return;
+			}
 
-				if (m_want_stemming) {
-					std::string stemmed = server()->stemmer().stem(word, lang, "");
-					rapidjson::Value sv(stemmed.c_str(), stemmed.size(), alloc);
-					tok.AddMember("stem", sv, alloc);
-				}
+			m_msgpack = warp::reply_writer::want_msgpack(http_req, false);
+			m_results.resize(m_batch.documents().size());
+			m_pending = m_batch.documents().size();
 
-				tokens.PushBack(tok, alloc);
+			if (m_batch.documents().empty()) {
+				send_results();
+				return;
 			}
 
-			member.AddMember("tokens", tokens, alloc);
+			// handler and request buffer are kept alive by the tasks, the last finished task sends the reply
+			auto self = shared_from_this();
+			for (size_t i = 0; i < m_batch.documents().size(); ++i) {
+				server()->compute().schedule([this, self, i] () {
+							process(i);
+
+							if (--m_pending == 0)
+								send_results();
+						});
+			}
 		}
 
-		void convert(rapidjson::Value &member, rapidjson::Document::AllocatorType &alloc,
-				const std::vector<ribosome::lstring> &all_words) {
-			std::vector<std::string> words, stems;
+	private:
+		warp::batch_request m_batch;
 
-			for (auto &w: all_words) {
-				auto word = ribosome::lconvert::to_string(w);
-				words.push_back(word);
+		bool m_msgpack = false;
 
-				std::string lang = server()->language(word);
+		// every document is written into its own slot, so tasks never touch the same string
+		std::vector<std::string> m_results;
+		std::atomic<size_t> m_pending{0};
 
-				if (m_want_stemming) {
-					stems.push_back(server()->stemmer().stem(word, lang, ""));
+		void process(size_t idx) {
+			const warp::batch_request::document &doc = m_batch.documents()[idx];
+
+			try {
+				std::string &out = m_results[idx];
+				warp::reply_writer writer(out, m_msgpack);
+
+				writer.StartObject(__builtin_popcount(doc.operations));
+				if (doc.operations & warp::batch_request::op_tokenize) {
+					document_processor proc(server(), true, doc.want_stemming, doc.want_urls, doc.fold);
+					writer.String("tokenize");
+					proc.write(writer, doc.text, doc.size);
+				}
+				if (doc.operations & warp::batch_request::op_convert) {
+					document_processor proc(server(), false, doc.want_stemming, doc.want_urls, doc.fold);
+					writer.String("convert");
+					proc.write(writer, doc.text, doc.size);
 				}
+				if (doc.operations & warp::batch_request::op_error_check) {
+					warp::error_checker<http_server> checker(server(), doc.level, doc.max_num, doc.fold);
+					writer.String("error_check");
+
+					auto err = checker.write(writer, doc.text, doc.size);
+					if (err) {
+						write_error(idx, err.code(), "could not check words: " + err.message());
+						return;
+					}
+				}
+				writer.EndObject();
+			} catch (const std::exception &e) {
+				write_error(idx, -EINVAL, e.what());
 			}
+		}
 
-			auto join = [] (const std::vector<std::string> &words) -> std::string {
-				std::ostringstream ss;
-				for (size_t i = 0; i < words.size(); ++i) {
-					ss << words[i];
-					if (i != words.size() - 1)
-						ss << " ";
-				}
-				return ss.str();
-			};
+		void write_error(size_t idx, int code, const std::string &message) {
+			std::string &out = m_results[idx];
+			out.clear();
+
+			warp::reply_writer writer(out, m_msgpack);
+			writer.StartObject(1);
+			writer.String("error");
+			writer.StartObject(2);
+			writer.String("message").String(message);
+			writer.String("code").Int(code);
+			writer.EndObject();
+			writer.EndObject();
+		}
 
-			std::string words_joined = join(words);
+		// results already are complete JSON or msgpack values, they are concatenated into the reply
+		void send_results() {
+			size_t size = 32;
+			for (const auto &r: m_results) {
+				size += r.size() + 1;
+			}
 
-			rapidjson::Value cv(words_joined.c_str(), words_joined.size(), alloc);
-			member.AddMember("text", cv, alloc);
+			std::string reply_data;
+			reply_data.reserve(size);
 
-			if (m_want_stemming) {
-				std::string stems_joined = join(stems);
-				rapidjson::Value sv(stems_joined.c_str(), stems_joined.size(), alloc);
-				member.AddMember("stem", sv, alloc);
+			warp::reply_writer writer(reply_data, m_msgpack);
+			if (m_msgpack) {
+				writer.StartObject(1);
+				writer.String("documents");
+				writer.StartArray(m_results.size());
+				for (const auto &r: m_results) {
+					reply_data.append(r);
+				}
+			} else {
+				reply_data.append("{\"documents\":[");
+				for (size_t i = 0; i < m_results.size(); ++i) {
+					if (i)
+						reply_data.push_back(',');
+					reply_data.append(m_results[i]);
+				}
+				reply_data.append("]}");
+				writer.finish();
 			}
-		}
 
+			send_reply_body(swarm::http_response::ok, writer.content_type(), std::move(reply_data));
+		}
 	};
 
+	// null if replies are not cached
+	warp::response_cache *cache() {
+		return m_cache.get();
+	}
+
+	warp::metrics &metrics() {
+		return m_metrics;
+	}
+
+	warp::thread_pool &compute() {
+		return *m_compute;
+	}
+
 	warp::stemmer &stemmer() {
 		return m_stemmer;
 	}
 
+	// writes "tokens" array of words with their positions, languages and optionally stems
+	void write_tokens(warp::reply_writer &writer, const std::map<std::string, std::vector<size_t>> &words,
+			const std::string &doc_lang, bool want_stemming) {
+		writer.String("tokens");
+		writer.StartArray(words.size());
+		for (auto &p: words) {
+			const auto &word = p.first;
+			const auto &positions = p.second;
+
+			std::string lang = language(word, doc_lang);
+
+			writer.StartObject(3 + want_stemming);
+			writer.String("word").String(word);
+			writer.String("language").String(lang);
+
+			writer.String("positions");
+			writer.StartArray(positions.size());
+			for (auto pos: positions) {
+				writer.Uint64(pos);
+			}
+			writer.EndArray();
+
+			if (want_stemming) {
+				writer.String("stem").String(m_stemmer.stem(word, lang, ""));
+			}
+
+			writer.EndObject();
+		}
+		writer.EndArray();
+	}
+
 	std::string language(const std::string &word) {
 		return m_lch.language(word);
 	}
@@ -310,6 +773,15 @@ public:
 	std::string language(const std::string &word, const ribosome::lstring &lw) {
 		return m_lch.language(word, lw);
 	}
+	std::string language(const std::string &word, const std::string &prior) {
+		return m_lch.language(word, prior);
+	}
+	std::string detect_document(const std::string &text) {
+		return m_lch.detect_document(text);
+	}
+	bool known_language(const std::string &lang) const {
+		return m_lch.known_language(lang);
+	}
 
 	ribosome::error_info detector_save(const std::string &text, const std::string &lang) {
 		return m_lch.detector_save(text, lang);
@@ -321,10 +793,23 @@ public:
 	ribosome::error_info check(const std::string &lang, const warp::check_control &ctl, std::vector<warp::dictionary::word_form> *ret) {
 		return m_lch.check(lang, ctl, ret);
 	}
+	ribosome::error_info check_batch(const std::vector<warp::check_control> &ctls, std::vector<warp::check_result> *ret) {
+		return m_lch.check_batch(ctls, ret);
+	}
+
+	ribosome::error_info complete(const std::string &lang, const std::string &prefix, size_t max_num,
+			std::vector<warp::completion_result> *ret) {
+		return m_lch.complete(lang, prefix, max_num, ret);
+	}
 
 private:
 	warp::stemmer m_stemmer;
 	warp::language_checker m_lch;
+	warp::metrics m_metrics;
+	std::unique_ptr<warp::response_cache> m_cache;
+
+	// destroyed first, so that pending tasks never see destroyed checker
+	std::unique_ptr<warp::thread_pool> m_compute;
 
 	bool lang_init(const rapidjson::Value &config) {
 		const char *lang_stats = warp::get_string(config, "language_detector_stats");
@@ -339,6 +824,15 @@ private:
 			return false;
 		}
 
+		const auto &dd = warp::get_object(config, "document_detection");
+		if (dd.IsObject()) {
+			double margin = 0.1;
+			if (dd.HasMember("margin") && dd["margin"].IsNumber())
+				margin = dd["margin"].GetDouble();
+
+			m_lch.set_detection_margin(margin, warp::get_int64(dd, "min_ngrams", 256));
+		}
+
 		auto &lm = warp::get_object(config, "language_models");
 		if (!lm.IsObject()) {
 			WLOG_ERROR("\"application.language_models\" must be object");
@@ -366,6 +860,12 @@ private:
 			}
 		}
 
+		err = m_lch.build_language_filter();
+		if (err) {
+			WLOG_ERROR("could not build language filter: %s [%d]", err.message().c_str(), err.code());
+			return false;
+		}
+
 		return true;
 	}
 
@@ -386,9 +886,13 @@ private:
 			if (replace)
 				lm->error.replace_path.assign(replace);
 			if (around)
-				lm->error.replace_path.assign(around);
+				lm->error.around_path.assign(around);
 		}
 
+		const char *completion = warp::get_string(config, "completion");
+		if (completion)
+			lm->completion_path.assign(completion);
+
 		return true;
 	}
 
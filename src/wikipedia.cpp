@@ -1,6 +1,8 @@
 #include "warp/alphabet.hpp"
 #include "warp/database.hpp"
 #include "warp/pack.hpp"
+#include "warp/tokenizer.hpp"
+#include "warp/utf8.hpp"
 
 #include <boost/iostreams/copy.hpp>
 #include <boost/iostreams/filtering_streambuf.hpp>
@@ -17,7 +19,6 @@
 
 #include <ribosome/error.hpp>
 #include <ribosome/lstring.hpp>
-#include <ribosome/split.hpp>
 #include <ribosome/timer.hpp>
 #include <ribosome/xml.hpp>
 
@@ -78,11 +79,11 @@ public:
 
 		auto &model = m_model[elm.thread_num];
 
-		ribosome::split spl;
-		auto all_words = spl.convert_split_words(elm.chars.data(), elm.chars.size(), warp::drop_characters);
+		warp::tokenizer tok(warp::drop_characters, warp::normalizer::fold_text);
+		tok.tokenize(elm.chars.data(), elm.chars.size());
 
-		for (auto &w: all_words) {
-			ribosome::lstring lw = ribosome::lconvert::to_lower(w);
+		for (const auto &t: tok.tokens()) {
+			ribosome::lstring lw = warp::utf8::to_lstring(tok.data(t), t.norm_size);
 
 			if (!m_alphabet.ok(lw))
 				continue;
@@ -91,7 +92,7 @@ public:
 			if (it == model.end()) {
 				warp::dictionary::word_form wf;
 				wf.lw = lw;
-				wf.word = ribosome::lconvert::to_string(lw);
+				wf.word = tok.word(t);
 				wf.freq = 1;
 				wf.documents = 1;
 				model.insert(std::make_pair<ribosome::lstring, warp::dictionary::word_form>(std::move(lw), std::move(wf)));
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/batch.hpp"
+
+#include "test.hpp"
+
+using namespace ioremap;
+
+static ribosome::error_info parse(warp::batch_request &batch, const std::string &data) {
+	return batch.parse(data.data(), data.size());
+}
+
+// document without "operations" is tokenized
+static int test_default_operations() {
+	warp::batch_request batch;
+	auto err = parse(batch, "{\"documents\": [{\"text\": \"first\"}, "
+			"{\"text\": \"second\", \"operations\": [\"convert\", \"error_check\"]}]}");
+	WARP_CHECK(!err);
+	WARP_CHECK(batch.documents().size() == 2);
+
+	const auto &first = batch.documents()[0];
+	WARP_CHECK(std::string(first.text, first.size) == "first");
+	WARP_CHECK(first.operations == warp::batch_request::op_tokenize);
+
+	const auto &second = batch.documents()[1];
+	WARP_CHECK(second.operations == (warp::batch_request::op_convert | warp::batch_request::op_error_check));
+	return 0;
+}
+
+static int test_malformed() {
+	const char *bad[] = {
+		"[]",
+		"{}",
+		"{\"documents\": 1}",
+		"{\"documents\": {\"text\": \"x\"}}",
+		"{\"documents\": [1]}",
+		"{\"documents\": [{\"text\": \"x\", \"operations\": \"tokenize\"}]}",
+		"{\"documents\": [{\"text\": \"x\", \"operations\": {\"a\": 1}}]}",
+		"{\"documents\": [{\"text\": \"x\", \"operations\": [\"unknown\"]}]}",
+	};
+
+	for (const char *data: bad) {
+		warp::batch_request batch;
+		auto err = parse(batch, data);
+		WARP_CHECK(err);
+	}
+
+	warp::batch_request batch;
+	WARP_CHECK(!parse(batch, "{\"documents\": []}"));
+	WARP_CHECK(batch.documents().empty());
+	return 0;
+}
+
+int main()
+{
+	const warp::test::test_case tests[] = {
+		{"default operations", test_default_operations},
+		{"malformed batches", test_malformed},
+	};
+
+	return warp::test::run(tests);
+}
@@ -0,0 +1,169 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/fuzzy.hpp"
+
+#include "test.hpp"
+
+using namespace ioremap;
+
+// uniform costs, transposition is cheaper than substitution
+struct test_costs {
+	float transpose_cost = 0.5;
+
+	float substitute(char, char) const {
+		return 1;
+	}
+	float insert(char) const {
+		return 1;
+	}
+	float remove(char) const {
+		return 1;
+	}
+	float transpose(char, char) const {
+		return transpose_cost;
+	}
+};
+
+static float damerau(const std::string &s, const std::string &t, float max_cost, int *edits = NULL) {
+	return warp::distance::weighted_damerau(s, t, test_costs(), max_cost, edits);
+}
+
+static bool equal(float a, float b) {
+	return std::fabs(a - b) < 1e-5;
+}
+
+static int test_edits() {
+	int edits = -1;
+	WARP_CHECK(equal(damerau("word", "word", 2, &edits), 0));
+	WARP_CHECK(edits == 0);
+
+	WARP_CHECK(equal(damerau("wrod", "word", 2, &edits), 0.5));
+	WARP_CHECK(edits == 1);
+
+	// insert and remove
+	WARP_CHECK(equal(damerau("wod", "word", 2, &edits), 1));
+	WARP_CHECK(edits == 1);
+	WARP_CHECK(equal(damerau("worrd", "word", 2, &edits), 1));
+	WARP_CHECK(edits == 1);
+	WARP_CHECK(equal(damerau("", "ab", 2, &edits), 2));
+	WARP_CHECK(edits == 2);
+	WARP_CHECK(equal(damerau("ab", "", 2, &edits), 2));
+	WARP_CHECK(edits == 2);
+
+	WARP_CHECK(equal(damerau("wxrd", "word", 2, &edits), 1));
+	WARP_CHECK(edits == 1);
+
+	// two transpositions are cheaper than two substitutions
+	WARP_CHECK(equal(damerau("owdr", "word", 2, &edits), 1));
+	WARP_CHECK(edits == 2);
+	return 0;
+}
+
+// transposition reads the row before the previous one, so a row which is entirely over the bound
+// does not mean the whole alignment is
+static int test_bound_with_transposition() {
+	WARP_CHECK(equal(damerau("ba", "ab", 0.6), 0.5));
+	WARP_CHECK(equal(damerau("xba", "xab", 0.6), 0.5));
+	WARP_CHECK(equal(damerau("bacd", "abcd", 0.5), 0.5));
+
+	test_costs costs;
+	costs.transpose_cost = 1;
+	WARP_CHECK(warp::distance::weighted_damerau(std::string("ba"), std::string("ab"), costs, 0.6) < 0);
+	return 0;
+}
+
+static int test_bound() {
+	WARP_CHECK(damerau("abcdef", "uvwxyz", 2) < 0);
+	WARP_CHECK(damerau("abc", "abcdef", 2) < 0);
+	WARP_CHECK(equal(damerau("abc", "abcde", 2), 2));
+	WARP_CHECK(damerau("abc", "xyz", 2.5) < 0);
+	WARP_CHECK(equal(damerau("abc", "xyz", 3), 3));
+
+	// early exit never changes the result within the bound
+	const char *words[] = { "", "a", "ab", "ba", "abc", "acb", "bca", "abcd", "badc", "dcba", "aabb" };
+	for (const char *s: words) {
+		for (const char *t: words) {
+			float full = damerau(s, t, 100);
+			for (float bound = 0; bound < 5; bound += 0.5) {
+				float cut = damerau(s, t, bound);
+				if (full <= bound) {
+					WARP_CHECK(equal(cut, full));
+				} else {
+					WARP_CHECK(cut < 0);
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+static warp::dictionary::word_form form(const std::string &word, int freq) {
+	warp::dictionary::word_form wf;
+	wf.word = word;
+	wf.lw = warp::utf8::to_lstring(word);
+	wf.freq = freq;
+	return wf;
+}
+
+static int test_ranking() {
+	warp::error_model::letter_error_model emod;
+	std::vector<warp::dictionary::word_form> words = {
+		form("halo", 10),
+		form("he", 5000),
+		form("help", 1000),
+		form("world", 100000),
+		form("hello", 100),
+		form("ehlo", 10),
+	};
+
+	ribosome::lstring lw = warp::utf8::to_lstring("helo");
+	auto ret = warp::noisy_channel_sort(lw, words, emod, 4, 10);
+
+	// "world" is over the edit bound, "he" needs two edits while the best candidate needs one transposition
+	WARP_CHECK(ret.size() == 4);
+	for (const auto &wf: ret) {
+		WARP_CHECK(wf.word != "world");
+		WARP_CHECK(wf.word != "he");
+	}
+
+	WARP_CHECK(ret[0].word == "help");
+	WARP_CHECK(ret[1].word == "hello");
+	WARP_CHECK(ret[2].word == "ehlo");
+	WARP_CHECK(ret[3].word == "halo");
+	WARP_CHECK(equal(ret[2].error_cost, emod.edit_costs().transpose));
+	WARP_CHECK(ret[2].edit_distance == 1);
+
+	for (size_t i = 1; i < ret.size(); ++i) {
+		WARP_CHECK(ret[i - 1].freq_norm >= ret[i].freq_norm);
+	}
+
+	ret = warp::noisy_channel_sort(lw, words, emod, 4, 2);
+	WARP_CHECK(ret.size() == 2);
+	WARP_CHECK(ret[0].word == "help");
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"edit operations", test_edits},
+		{"bound with transposition", test_bound_with_transposition},
+		{"bound", test_bound},
+		{"noisy channel ranking", test_ranking},
+	};
+
+	return warp::test::run(tests);
+}
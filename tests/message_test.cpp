@@ -0,0 +1,129 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/message.hpp"
+
+#include "test.hpp"
+
+using namespace ioremap;
+
+// {"request": {"text": <40 bytes>}} the way Go vmihailenco/msgpack packs it: fixstr keys, str8 value
+static int test_msgpack_str8() {
+	std::string value = "привет, ";
+	value.resize(40, 'x');
+
+	std::string data;
+	data.push_back((char)0x81);
+	data.push_back((char)0xa7);
+	data += "request";
+	data.push_back((char)0x81);
+	data.push_back((char)0xa4);
+	data += "text";
+	data.push_back((char)0xd9);
+	data.push_back((char)value.size());
+	data += value;
+
+	warp::request_body body;
+	auto err = body.parse(true, data.data(), data.size());
+	WARP_CHECK(!err);
+	WARP_CHECK(body.members().size() == 1);
+
+	const warp::request_member &m = body.members()[0];
+	WARP_CHECK(std::string(m.name, m.name_size) == "text");
+	WARP_CHECK(std::string(m.value, m.value_size) == value);
+	return 0;
+}
+
+// the same member as bin8, older clients send byte slices this way
+static int test_msgpack_bin8() {
+	std::string value(40, 'y');
+
+	std::string data;
+	data.push_back((char)0x81);
+	data.push_back((char)0xa7);
+	data += "request";
+	data.push_back((char)0x81);
+	data.push_back((char)0xa4);
+	data += "text";
+	data.push_back((char)0xc4);
+	data.push_back((char)value.size());
+	data += value;
+
+	warp::request_body body;
+	auto err = body.parse(true, data.data(), data.size());
+	WARP_CHECK(!err);
+	WARP_CHECK(body.members().size() == 1);
+	WARP_CHECK(std::string(body.members()[0].value, body.members()[0].value_size) == value);
+	return 0;
+}
+
+// reply strings must be STR, clients decode BIN into byte arrays instead of strings
+static int test_reply_strings() {
+	std::string long_value(40, 'z');
+
+	std::string data;
+	warp::reply_writer writer(data, true);
+	writer.StartObject(2);
+	writer.String("text").String(long_value);
+	writer.String("language").String("russian");
+	writer.EndObject();
+	writer.finish();
+
+	msgpack::unpacked msg;
+	msgpack::unpack(&msg, data.data(), data.size());
+
+	const msgpack::object &root = msg.get();
+	WARP_CHECK(root.type == msgpack::type::MAP);
+	WARP_CHECK(root.via.map.size == 2);
+
+	for (uint32_t i = 0; i < root.via.map.size; ++i) {
+		const msgpack::object_kv &kv = root.via.map.ptr[i];
+#if defined(MSGPACK_VERSION_MAJOR) && MSGPACK_VERSION_MAJOR >= 1
+		WARP_CHECK(kv.key.type == msgpack::type::STR);
+		WARP_CHECK(kv.val.type == msgpack::type::STR);
+#else
+		WARP_CHECK(kv.key.type == msgpack::type::RAW);
+		WARP_CHECK(kv.val.type == msgpack::type::RAW);
+#endif
+	}
+
+	// what the server writes is read back by its own request parser
+	std::string request;
+	warp::reply_writer req_writer(request, true);
+	req_writer.StartObject(1);
+	req_writer.String("request");
+	req_writer.StartObject(1);
+	req_writer.String("text").String(long_value);
+	req_writer.EndObject();
+	req_writer.EndObject();
+
+	warp::request_body body;
+	WARP_CHECK(!body.parse(true, request.data(), request.size()));
+	WARP_CHECK(body.members().size() == 1);
+	WARP_CHECK(std::string(body.members()[0].value, body.members()[0].value_size) == long_value);
+	return 0;
+}
+
+int main()
+{
+	const warp::test::test_case tests[] = {
+		{"msgpack str8 request member", test_msgpack_str8},
+		{"msgpack bin8 request member", test_msgpack_bin8},
+		{"msgpack reply strings", test_reply_strings},
+	};
+
+	return warp::test::run(tests);
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/ngram.hpp"
+
+#include "test.hpp"
+
+using namespace ioremap;
+
+typedef warp::probability<std::string> prob_t;
+typedef warp::fused_index<std::string> index_t;
+
+static const char *training[] = {
+	"the quick brown fox jumps over the lazy dog and then the dog sleeps in the shade of the old tree",
+	"der schnelle braune fuchs springt ueber den faulen hund und dann schlaeft der hund im schatten",
+	"le renard brun rapide saute par dessus le chien paresseux et puis le chien dort a l'ombre",
+};
+
+static const char *queries[] = {
+	"the dog is lazy",
+	"der hund schlaeft",
+	"le chien dort",
+	"zzzz",
+	"",
+	"a",
+	"over the brown hund et le renard",
+};
+
+static const char *names[] = { "en", "de", "fr" };
+
+static std::vector<prob_t> train() {
+	std::vector<prob_t> probs;
+	for (const char *text: training) {
+		prob_t p(3);
+		p.load_text(text);
+		p.sort();
+		probs.emplace_back(p);
+	}
+
+	return probs;
+}
+
+static bool build(const std::vector<prob_t> &probs, index_t *idx) {
+	std::vector<const prob_t *> ptrs;
+	for (const auto &p: probs)
+		ptrs.push_back(&p);
+
+	return idx->build(ptrs, warp::ngram<std::string>().profile_limit);
+}
+
+// index of the language with the smallest per-language score, the first one wins on ties
+static size_t scalar_best(const std::vector<prob_t> &probs, const std::string &text) {
+	size_t best = 0;
+	for (size_t l = 1; l < probs.size(); ++l) {
+		if (probs[l].score(text) < probs[best].score(text))
+			best = l;
+	}
+
+	return best;
+}
+
+// score computed directly from the sorted profile, the way it was done before hashed tables
+template <typename S>
+static size_t profile_score(const warp::ngram<S> &ng, const S &text) {
+	size_t score = 0;
+	for (const auto &word: warp::ngram<S>::split(text, ng.n())) {
+		auto it = ng.profile().find(word);
+		score += it == ng.profile().end() ? ng.profile_limit : it->second;
+	}
+
+	return score;
+}
+
+template <typename S>
+static int check_table_score(const std::vector<S> &train, const std::vector<S> &texts) {
+	for (int n = 1; n <= 8; ++n) {
+		warp::ngram<S> ng(n);
+		for (const auto &t: train)
+			ng.load(t);
+		ng.sort();
+
+		for (const auto &t: texts) {
+			WARP_CHECK(ng.score(t) == profile_score(ng, t));
+		}
+
+		// reloaded profile is compiled again
+		warp::ngram<S> copy = ng.profile_copy();
+		copy.compile();
+		for (const auto &t: texts) {
+			WARP_CHECK(copy.score(t) == ng.score(t));
+		}
+	}
+
+	return 0;
+}
+
+// hashed profile gives the same score as profile map, n-grams which do not fit 64 bits use the map
+static int test_hashed_profile() {
+	std::vector<std::string> train(training, training + 3);
+	std::vector<std::string> texts(queries, queries + sizeof(queries) / sizeof(queries[0]));
+	texts.insert(texts.end(), train.begin(), train.end());
+	if (check_table_score(train, texts))
+		return -1;
+
+	std::vector<ribosome::lstring> ltrain, ltexts;
+	for (const auto &t: train)
+		ltrain.push_back(ribosome::lconvert::from_utf8(t));
+	for (const auto &t: texts)
+		ltexts.push_back(ribosome::lconvert::from_utf8(t));
+	ltrain.push_back(ribosome::lconvert::from_utf8("съешь же ещё этих мягких французских булок да выпей чаю"));
+	ltexts.push_back(ribosome::lconvert::from_utf8("ещё чаю"));
+	return check_table_score(ltrain, ltexts);
+}
+
+static int test_ngram_table() {
+	warp::ngram_table table;
+	WARP_CHECK(table.find(1, 42) == 42);
+
+	for (uint64_t key = 0; key < 10000; ++key) {
+		table.insert(key * 0x10001, key);
+	}
+	WARP_CHECK(table.size() == 10000);
+
+	// existing key is updated in place
+	table.insert(0x10001 * 7, 100);
+	WARP_CHECK(table.size() == 10000);
+	WARP_CHECK(table.find(0x10001 * 7, 0) == 100);
+
+	for (uint64_t key = 0; key < 10000; ++key) {
+		if (key != 7)
+			WARP_CHECK(table.find(key * 0x10001, 1000000) == key);
+		WARP_CHECK(table.find(key * 0x10001 + 1, 1000000) == 1000000);
+	}
+
+	WARP_CHECK(warp::ngram_code<std::string>::packable(7));
+	WARP_CHECK(!warp::ngram_code<std::string>::packable(8));
+	WARP_CHECK(warp::ngram_code<ribosome::lstring>::packable(3));
+	WARP_CHECK(!warp::ngram_code<ribosome::lstring>::packable(4));
+	return 0;
+}
+
+static std::string model_path() {
+	return "warp_ngram_test.model";
+}
+
+static std::string read_file(const std::string &path) {
+	std::ifstream in(path.c_str(), std::ios::binary);
+	std::ostringstream ss;
+	ss << in.rdbuf();
+	return ss.str();
+}
+
+static int open_data(const std::string &data) {
+	std::string path = model_path() + ".bad";
+	std::ofstream out(path.c_str(), std::ios::trunc | std::ios::binary);
+	out.write(data.data(), data.size());
+	out.close();
+
+	index_t idx;
+	std::vector<std::string> tmp;
+	int err = idx.open(path.c_str(), &tmp);
+	unlink(path.c_str());
+	return err;
+}
+
+static int test_fused_matches_probability() {
+	std::vector<prob_t> probs = train();
+	index_t idx;
+	WARP_CHECK(build(probs, &idx));
+	WARP_CHECK(idx.num_languages() == probs.size());
+
+	for (const char *q: queries) {
+		WARP_CHECK(idx.best(q) == scalar_best(probs, q));
+		// without early exit whole text is scanned
+		WARP_CHECK(idx.best_prefix(q, 0, 0) == scalar_best(probs, q));
+	}
+
+	for (size_t l = 0; l < probs.size(); ++l) {
+		WARP_CHECK(idx.best(training[l]) == l);
+	}
+	return 0;
+}
+
+// language without profile for some n-gram length gets zero rank for it, as in probability::score()
+static int test_fused_missing_levels() {
+	std::vector<prob_t> probs;
+	for (int i = 0; i < 3; ++i) {
+		prob_t p(2 + i);
+		p.load_text(training[i]);
+		p.sort();
+		probs.emplace_back(p);
+	}
+
+	index_t idx;
+	WARP_CHECK(build(probs, &idx));
+	for (const char *q: queries) {
+		WARP_CHECK(idx.best(q) == scalar_best(probs, q));
+	}
+
+	// identical profiles tie, the first language wins
+	std::vector<prob_t> same(2, probs[0]);
+	WARP_CHECK(build(same, &idx));
+	WARP_CHECK(idx.best(training[1]) == 0);
+	return 0;
+}
+
+static int test_detector() {
+	warp::detector<std::string, std::string> det;
+	for (size_t l = 0; l < 3; ++l) {
+		det.load_text(training[l], names[l]);
+	}
+	det.sort();
+	WARP_CHECK(det.languages().size() == 3);
+
+	// detector keeps languages in name order
+	std::vector<prob_t> probs = train();
+	std::map<std::string, prob_t> by_name;
+	for (size_t l = 0; l < 3; ++l) {
+		by_name.insert(std::make_pair(names[l], probs[l]));
+	}
+
+	std::vector<std::string> sorted_names;
+	std::vector<prob_t> sorted_probs;
+	for (const auto &p: by_name) {
+		sorted_names.push_back(p.first);
+		sorted_probs.push_back(p.second);
+	}
+	WARP_CHECK(det.languages() == sorted_names);
+
+	for (const char *q: queries) {
+		WARP_CHECK(det.detect(q) == sorted_names[scalar_best(sorted_probs, q)]);
+	}
+	return 0;
+}
+
+// early exit stops on decisive text before its end and gives the same answer
+static int test_best_prefix() {
+	std::vector<prob_t> probs = train();
+	index_t idx;
+	WARP_CHECK(build(probs, &idx));
+
+	for (size_t l = 0; l < probs.size(); ++l) {
+		std::string text;
+		for (int i = 0; i < 20; ++i)
+			text += std::string(training[l]) + " ";
+
+		size_t all = 0, scanned = 0;
+		WARP_CHECK(idx.best_prefix(text, 0, 0, &all) == l);
+		// bigrams and trigrams
+		WARP_CHECK(all == (text.size() - 1) + (text.size() - 2));
+
+		WARP_CHECK(idx.best_prefix(text, 0.1, 64, &scanned) == l);
+		WARP_CHECK(scanned >= 64);
+		WARP_CHECK(scanned < all);
+
+		// minimal number of n-grams is scanned even when the first check would stop
+		WARP_CHECK(idx.best_prefix(text, 0.1, all, &scanned) == l);
+		WARP_CHECK(scanned == all);
+	}
+	return 0;
+}
+
+static int test_compiled_roundtrip() {
+	std::vector<prob_t> probs = train();
+	index_t idx;
+	WARP_CHECK(build(probs, &idx));
+
+	std::vector<std::string> in_names(names, names + 3);
+	WARP_CHECK(idx.write(model_path().c_str(), in_names) == 0);
+	WARP_CHECK(index_t::is_compiled(model_path().c_str()));
+
+	index_t mapped;
+	std::vector<std::string> out_names;
+	int err = mapped.open(model_path().c_str(), &out_names);
+	unlink(model_path().c_str());
+	WARP_CHECK(err == 0);
+	WARP_CHECK(out_names == in_names);
+
+	for (const char *q: queries) {
+		WARP_CHECK(mapped.best(q) == idx.best(q));
+	}
+	return 0;
+}
+
+// every prefix of a valid model with fixed up size field is rejected without reading past the file
+static int test_truncated_model() {
+	std::vector<prob_t> probs = train();
+	index_t idx;
+	WARP_CHECK(build(probs, &idx));
+	WARP_CHECK(idx.write(model_path().c_str(), std::vector<std::string>(names, names + 3)) == 0);
+	std::string data = read_file(model_path());
+	unlink(model_path().c_str());
+
+	WARP_CHECK(open_data(data) == 0);
+	for (size_t size = 0; size < data.size(); size += 4) {
+		std::string part = data.substr(0, size);
+		if (size >= sizeof(warp::model_header))
+			((warp::model_header *)&part[0])->size = size;
+
+		WARP_CHECK(open_data(part) == -EINVAL);
+	}
+	return 0;
+}
+
+static int test_corrupted_model() {
+	std::vector<prob_t> probs = train();
+	index_t idx;
+	WARP_CHECK(build(probs, &idx));
+	WARP_CHECK(idx.write(model_path().c_str(), std::vector<std::string>(names, names + 3)) == 0);
+	const std::string data = read_file(model_path());
+	unlink(model_path().c_str());
+
+	const size_t offsets_pos = sizeof(warp::model_header);
+	const size_t level_pos = (offsets_pos + 4 * sizeof(uint32_t) + 6 + 7) & ~7UL;
+
+	std::string bad;
+	const uint32_t huge32[] = { 0, 0x40000000, 0x7fffffff, 0xffffffff };
+	for (uint32_t v: huge32) {
+		bad = data;
+		((warp::model_header *)&bad[0])->num_languages = v;
+		WARP_CHECK(open_data(bad) == -EINVAL);
+
+		bad = data;
+		((warp::model_header *)&bad[0])->num_levels = v ? v : 1000;
+		WARP_CHECK(open_data(bad) == -EINVAL);
+
+		bad = data;
+		((uint32_t *)&bad[offsets_pos])[3] = v ? v : 1;
+		WARP_CHECK(open_data(bad) == -EINVAL);
+
+		bad = data;
+		((warp::model_level_header *)&bad[level_pos])->num_rows = v ? v : 0x10000;
+		WARP_CHECK(open_data(bad) == -EINVAL);
+	}
+
+	const uint64_t huge64[] = { 0, 3, 1ULL << 40, 1ULL << 63 };
+	for (uint64_t v: huge64) {
+		bad = data;
+		((warp::model_level_header *)&bad[level_pos])->num_slots = v;
+		WARP_CHECK(open_data(bad) == -EINVAL);
+	}
+
+	// name offsets must not go backwards
+	bad = data;
+	((uint32_t *)&bad[offsets_pos])[1] = 5;
+	WARP_CHECK(open_data(bad) == -EINVAL);
+
+	bad = data;
+	bad[0] = 'x';
+	WARP_CHECK(open_data(bad) == -EINVAL);
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"ngram table", test_ngram_table},
+		{"hashed profile matches profile map", test_hashed_profile},
+		{"fused index matches per-language scores", test_fused_matches_probability},
+		{"fused index with missing levels", test_fused_missing_levels},
+		{"detector", test_detector},
+		{"early exit", test_best_prefix},
+		{"compiled model roundtrip", test_compiled_roundtrip},
+		{"truncated model", test_truncated_model},
+		{"corrupted model", test_corrupted_model},
+	};
+
+	return warp::test::run(tests);
+}
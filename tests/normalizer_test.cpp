@@ -0,0 +1,161 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/normalizer.hpp"
+
+#include "test.hpp"
+
+#include <random>
+
+using namespace ioremap;
+
+typedef warp::normalizer norm_t;
+
+static int test_lowercase() {
+	norm_t norm;
+
+	WARP_CHECK(norm.normalize("") == "");
+	WARP_CHECK(norm.normalize("Hello World") == "hello world");
+	WARP_CHECK(norm.normalize("\xd0\x9f\xd0\xa0\xd0\x98\xd0\x92\xd0\x95\xd0\xa2") ==
+			"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82");
+
+	// ASCII runs around 16-byte vectorized blocks and 64-byte chunks
+	for (size_t size = 1; size < 200; ++size) {
+		std::string upper, lower;
+		for (size_t i = 0; i < size; ++i) {
+			upper.push_back('A' + i % 26);
+			lower.push_back('a' + i % 26);
+		}
+
+		WARP_CHECK(norm.normalize(upper) == lower);
+		WARP_CHECK(norm.normalize(upper + "1" + upper) == lower + "1" + lower);
+		WARP_CHECK(norm.normalize(upper + "\xd0\x96" + upper) == lower + "\xd0\xb6" + lower);
+		WARP_CHECK(norm.normalize("[" + upper + "]") == "[" + lower + "]");
+	}
+	return 0;
+}
+
+// runs of separators become single space, leading and trailing ones are dropped
+static int test_spaces() {
+	norm_t norm(",");
+
+	WARP_CHECK(norm.normalize("  a \t\n b  ") == "a b");
+	WARP_CHECK(norm.normalize(",,a,,b,,") == "a b");
+	WARP_CHECK(norm.normalize(" \t ,") == "");
+	WARP_CHECK(norm.normalize("a\xc2\xa0\xe2\x80\x83\xe3\x80\x80" "b") == "a b");
+
+	// normalized text is appended
+	std::string out = "prefix:";
+	norm.normalize("  A  B ", 7, &out);
+	WARP_CHECK(out == "prefix:a b");
+	return 0;
+}
+
+static int test_folding() {
+	const std::string yo = "\xd0\x81\xd0\xbb\xd0\xba\xd0\xb0 \xd1\x91\xd0\xb6";
+	const std::string punct = "a\xe2\x80\x94" "b \xc2\xab" "c\xc2\xbb";
+	const std::string digits = "a1b 22";
+
+	// nothing is folded by default
+	norm_t plain;
+	WARP_CHECK(plain.normalize(yo) == "\xd1\x91\xd0\xbb\xd0\xba\xd0\xb0 \xd1\x91\xd0\xb6");
+	WARP_CHECK(plain.normalize(punct) == "a\xe2\x80\x94" "b \xc2\xab" "c\xc2\xbb");
+	WARP_CHECK(plain.normalize(digits) == "a1b 22");
+
+	norm_t yo_norm("", norm_t::fold_yo);
+	WARP_CHECK(yo_norm.normalize(yo) == "\xd0\xb5\xd0\xbb\xd0\xba\xd0\xb0 \xd0\xb5\xd0\xb6");
+	WARP_CHECK(yo_norm.normalize(punct) == plain.normalize(punct));
+
+	norm_t punct_norm("", norm_t::fold_punctuation);
+	WARP_CHECK(punct_norm.normalize(punct) == "a b c");
+	WARP_CHECK(punct_norm.normalize(yo) == plain.normalize(yo));
+
+	norm_t digits_norm("", norm_t::fold_digits);
+	WARP_CHECK(digits_norm.normalize(digits) == "a b");
+
+	norm_t text(",", norm_t::fold_text);
+	WARP_CHECK(text.normalize(yo + "," + punct + " " + digits) ==
+			"\xd0\xb5\xd0\xbb\xd0\xba\xd0\xb0 \xd0\xb5\xd0\xb6 a b c a1b 22");
+	return 0;
+}
+
+static int test_map() {
+	norm_t norm(",", norm_t::fold_text);
+
+	WARP_CHECK(norm.map('A') == 'a');
+	WARP_CHECK(norm.map(',') == 0);
+	WARP_CHECK(norm.map(' ') == 0);
+	WARP_CHECK(norm.map(0x401) == 0x435);
+	WARP_CHECK(norm.map(0x451) == 0x435);
+	WARP_CHECK(norm.map(0x416) == 0x436);
+	WARP_CHECK(norm.map(0xa0) == 0);
+	WARP_CHECK(norm.map(0x2014) == 0);
+	WARP_CHECK(norm.map(0x1f600) == 0);
+
+	// joiners and soft hyphen are kept
+	WARP_CHECK(norm.map(0x200d) == 0x200d);
+	WARP_CHECK(norm.map(0xad) == 0xad);
+	WARP_CHECK(norm.map(0xfffd) == 0xfffd);
+	return 0;
+}
+
+// normalized text is the same as lowercasing and splitting every code point separately
+static int test_random() {
+	const uint32_t codes[] = {
+		'a', 'Z', ' ', '\t', ',', '1', 0x401, 0x451, 0x416, 0x436, 0xa0, 0x2014, 0x3000, 0x200d, 0xfffd,
+	};
+
+	norm_t norm(",", norm_t::fold_text);
+	std::mt19937 rng(1);
+	for (int i = 0; i < 20000; ++i) {
+		ribosome::lstring ls;
+		size_t size = rng() % 50;
+		for (size_t j = 0; j < size; ++j)
+			ls.push_back(ribosome::letter(codes[rng() % (sizeof(codes) / sizeof(codes[0]))]));
+
+		std::string expected;
+		bool space = false;
+		for (const auto &l: ls) {
+			uint32_t c = norm.map(l.l);
+			if (!c) {
+				space = true;
+				continue;
+			}
+
+			if (space && expected.size())
+				expected.push_back(' ');
+			space = false;
+
+			char tmp[4];
+			expected.append(tmp, warp::utf8::encode_one(c, tmp));
+		}
+
+		WARP_CHECK(norm.normalize(warp::utf8::to_string(ls)) == expected);
+	}
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"lowercase", test_lowercase},
+		{"spaces", test_spaces},
+		{"folding", test_folding},
+		{"code point map", test_map},
+		{"random text", test_random},
+	};
+
+	return warp::test::run(tests);
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/norvig.hpp"
+
+#include "test.hpp"
+
+#include <unistd.h>
+
+using namespace ioremap;
+
+/*
+ * Reference edits1() which builds every candidate as separate string and drops duplicates
+ * with std::set, this is how candidates were generated before the arena.
+ */
+class set_model {
+public:
+	set_model(const warp::error_model::letter_error_model &emod) : m_emod(emod) {}
+
+	std::set<ribosome::lstring> edits1(const ribosome::lstring &vs) const {
+		std::set<ribosome::lstring> ret;
+
+		for (size_t i = 0; i <= vs.size(); ++i) {
+			ribosome::lstring a(vs.begin(), vs.begin() + i);
+			ribosome::lstring b(vs.begin() + i, vs.end());
+
+			if (b.size() > 0) {
+				ribosome::lstring tmp = a;
+				tmp.insert(tmp.end(), b.begin() + 1, b.end());
+				ret.emplace(tmp);
+			}
+
+			if (b.size() > 1) {
+				ribosome::lstring tmp = a;
+				tmp.push_back(b[1]);
+				tmp.push_back(b[0]);
+				tmp.insert(tmp.end(), b.begin() + 2, b.end());
+				ret.emplace(tmp);
+			}
+
+			if (b.size() > 0 && a.size() > 0) {
+				for (auto &l: m_emod.transform(b.front(), a.size())) {
+					ribosome::lstring tmp = a;
+					tmp.push_back(l);
+					tmp.insert(tmp.end(), b.begin() + 1, b.end());
+					ret.emplace(tmp);
+				}
+			}
+
+			if (a.size() > 0) {
+				for (auto &l: m_emod.transform(a.back(), a.size())) {
+					ribosome::lstring tmp = a;
+					tmp.push_back(l);
+					tmp.insert(tmp.end(), b.begin(), b.end());
+					ret.emplace(tmp);
+				}
+			}
+		}
+
+		return ret;
+	}
+
+	// every distance-1 candidate and every edit of them
+	std::set<ribosome::lstring> edits2(const ribosome::lstring &vs) const {
+		std::set<ribosome::lstring> ret = edits1(vs);
+
+		for (auto &w: edits1(vs)) {
+			std::set<ribosome::lstring> tmp = edits1(w);
+			ret.insert(tmp.begin(), tmp.end());
+		}
+
+		return ret;
+	}
+
+private:
+	const warp::error_model::letter_error_model &m_emod;
+};
+
+static const char *words[] = {
+	"",
+	"a",
+	"aa",
+	"abc",
+	"aaab",
+	"word",
+	"привет",
+	"ёлка",
+	"a longer phrase to grow the table",
+};
+
+static bool write_map(const std::string &path, const char *data) {
+	std::ofstream out(path.c_str(), std::ios::trunc);
+	out << data;
+	out.close();
+	return out.good();
+}
+
+static int check_model(const warp::norvig::lang_model &model) {
+	set_model ref(model.error_model());
+
+	for (const char *w: words) {
+		ribosome::lstring lw = warp::utf8::to_lstring(w);
+		WARP_CHECK(model.edits1(lw) == ref.edits1(lw));
+
+		if (lw.size() < 10) {
+			WARP_CHECK(model.edits2(lw) == ref.edits2(lw));
+		}
+	}
+
+	return 0;
+}
+
+static int test_same_as_set() {
+	warp::norvig::lang_model model;
+	return check_model(model);
+}
+
+static int test_same_as_set_with_error_model() {
+	std::string replace = "warp_norvig_test.replace", around = "warp_norvig_test.around";
+	WARP_CHECK(write_map(replace, "а о\nе ёи\nо а\nw v\n"));
+	WARP_CHECK(write_map(around, "а св\nр кп\nо лр\nb vn\na sq\n"));
+
+	warp::norvig::lang_model model;
+	auto err = model.load_error_model_replace(replace);
+	unlink(replace.c_str());
+	if (!err)
+		err = model.load_error_model_around(around);
+	unlink(around.c_str());
+	WARP_CHECK(!err);
+
+	return check_model(model);
+}
+
+// every candidate is reported once with its smallest distance, generation stops when callback asks to
+static int test_for_each_edit() {
+	warp::norvig::lang_model model;
+	ribosome::lstring lw = warp::utf8::to_lstring("word");
+	set_model ref(model.error_model());
+	std::set<ribosome::lstring> e1 = ref.edits1(lw);
+
+	std::set<ribosome::lstring> seen;
+	int prev_distance = 1;
+	model.for_each_edit(lw, 2, [&] (const ribosome::letter *ptr, size_t size, int distance) -> bool {
+				ribosome::lstring s(ptr, ptr + size);
+				bool inserted = seen.insert(s).second;
+				bool distance_ok = (distance == 1) == (e1.find(s) != e1.end());
+
+				// distance-2 candidates are produced after all distance-1 ones
+				bool order_ok = distance >= prev_distance;
+				prev_distance = distance;
+				return inserted && distance_ok && order_ok;
+			});
+	WARP_CHECK(seen == ref.edits2(lw));
+
+	size_t calls = 0;
+	model.for_each_edit(lw, 2, [&] (const ribosome::letter *, size_t, int) -> bool {
+				return ++calls < 3;
+			});
+	WARP_CHECK(calls == 3);
+
+	calls = 0;
+	model.for_each_edit(lw, 0, [&] (const ribosome::letter *, size_t, int) -> bool {
+				++calls;
+				return true;
+			});
+	WARP_CHECK(calls == 0);
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"arena edits match std::set edits", test_same_as_set},
+		{"arena edits match std::set edits with error model", test_same_as_set_with_error_model},
+		{"for_each_edit", test_for_each_edit},
+	};
+
+	return warp::test::run(tests);
+}
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __WARP_TESTS_TEST_HPP
+#define __WARP_TESTS_TEST_HPP
+
+#include <iostream>
+
+/*
+ * Every test is a function which returns 0 on success, WARP_CHECK() prints failed condition
+ * and returns -1 from the test. run() runs all tests and returns process exit status.
+ */
+#define WARP_CHECK(cond) do {								\
+		if (!(cond)) {								\
+			std::cerr << __FILE__ << ":" << __LINE__ << ": " #cond << std::endl;	\
+			return -1;							\
+		}									\
+	} while (0)
+
+namespace ioremap { namespace warp { namespace test {
+
+struct test_case {
+	const char	*name;
+	int		(*func)();
+};
+
+template <size_t N>
+static inline int run(const test_case (&tests)[N]) {
+	int failed = 0;
+	for (const auto &t: tests) {
+		if (t.func()) {
+			std::cerr << t.name << ": FAILED" << std::endl;
+			failed++;
+		} else {
+			std::cout << t.name << ": ok" << std::endl;
+		}
+	}
+
+	return failed ? 1 : 0;
+}
+
+}}} // namespace ioremap::warp::test
+
+#endif /* __WARP_TESTS_TEST_HPP */
@@ -0,0 +1,196 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/tokenizer.hpp"
+
+#include "test.hpp"
+
+#include <random>
+
+using namespace ioremap;
+
+// source spans and normalized words of every token
+static int tokenize(warp::tokenizer &tok, const std::string &text,
+		std::vector<std::string> *spans, std::vector<std::string> *words) {
+	tok.tokenize(text);
+	spans->clear();
+	words->clear();
+
+	std::string joined;
+	for (const auto &t: tok.tokens()) {
+		WARP_CHECK(t.offset + t.size <= text.size());
+		WARP_CHECK(t.size > 0);
+		WARP_CHECK(t.norm_size > 0);
+		WARP_CHECK(std::string(tok.data(t), t.norm_size) == tok.word(t));
+
+		spans->push_back(text.substr(t.offset, t.size));
+		words->push_back(tok.word(t));
+
+		if (joined.size())
+			joined.push_back(' ');
+		joined += tok.word(t);
+	}
+
+	// normalized text is the words separated by single space
+	WARP_CHECK(tok.normalized() == joined);
+	return 0;
+}
+
+typedef std::vector<std::string> sv;
+
+static int test_ascii_split() {
+	warp::tokenizer tok(",.");
+	sv spans, words;
+
+	WARP_CHECK(!tokenize(tok, "", &spans, &words));
+	WARP_CHECK(spans.empty());
+
+	WARP_CHECK(!tokenize(tok, " \t\r\n ", &spans, &words));
+	WARP_CHECK(spans.empty());
+
+	WARP_CHECK(!tokenize(tok, "Hello, World.x  Tab\tnew\nline", &spans, &words));
+	WARP_CHECK(spans == sv({"Hello", "World", "x", "Tab", "new", "line"}));
+	WARP_CHECK(words == sv({"hello", "world", "x", "tab", "new", "line"}));
+
+	// characters which are not separators stay in words
+	WARP_CHECK(!tokenize(tok, "  it's a-b 42!  ", &spans, &words));
+	WARP_CHECK(spans == sv({"it's", "a-b", "42!"}));
+
+	// letter used as separator disables vectorized lowercasing, separators are case sensitive
+	warp::tokenizer letters("x");
+	WARP_CHECK(!tokenize(letters, "AAAAAAAAAAAAAAAAAAAAxBBBBBBBBBBBBBBBBBBBB", &spans, &words));
+	WARP_CHECK(words == sv({std::string(20, 'a'), std::string(20, 'b')}));
+	WARP_CHECK(!tokenize(letters, "aXa", &spans, &words));
+	WARP_CHECK(words == sv({"axa"}));
+	return 0;
+}
+
+// words around 16-byte vectorized runs and 64-byte chunks keep their bounds
+static int test_long_words() {
+	warp::tokenizer tok;
+	sv spans, words;
+
+	for (size_t first = 1; first < 150; first += 7) {
+		for (size_t second = 1; second < 80; second += 5) {
+			std::string a(first, 'Q'), b(second, 'z');
+			std::string text = a + " " + b + "\xd0\x96" + b + " x";
+
+			WARP_CHECK(!tokenize(tok, text, &spans, &words));
+			WARP_CHECK(spans.size() == 3);
+			WARP_CHECK(spans[0] == a);
+			WARP_CHECK(spans[1] == b + "\xd0\x96" + b);
+			WARP_CHECK(words[0] == std::string(first, 'q'));
+			WARP_CHECK(words[1] == b + "\xd0\xb6" + b);
+			WARP_CHECK(words[2] == "x");
+		}
+	}
+	return 0;
+}
+
+static int test_unicode_split() {
+	warp::tokenizer tok;
+	sv spans, words;
+
+	// no-break space, em space, ideographic space and line separator
+	WARP_CHECK(!tokenize(tok, "a\xc2\xa0" "b\xe2\x80\x83" "c\xe3\x80\x80" "d\xe2\x80\xa8" "e", &spans, &words));
+	WARP_CHECK(spans == sv({"a", "b", "c", "d", "e"}));
+
+	// guillemets, em dash, curly quotes, ellipsis and fullwidth comma
+	WARP_CHECK(!tokenize(tok, "\xc2\xab\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82\xc2\xbb\xe2\x80\x94"
+				"\xe2\x80\x9cok\xe2\x80\x9d\xe2\x80\xa6yes\xef\xbc\x8cno", &spans, &words));
+	WARP_CHECK(words == sv({"\xd0\xbf\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82", "ok", "yes", "no"}));
+
+	// zero width joiner and soft hyphen stay inside words
+	WARP_CHECK(!tokenize(tok, "ab\xe2\x80\x8d" "cd e\xc2\xad" "f", &spans, &words));
+	WARP_CHECK(spans == sv({"ab\xe2\x80\x8d" "cd", "e\xc2\xad" "f"}));
+
+	// separator at the very end and word made of multibyte letters only
+	WARP_CHECK(!tokenize(tok, "\xd0\x81\xd0\x9b\xd0\x9a\xd0\x90\xe2\x80\x94", &spans, &words));
+	WARP_CHECK(spans == sv({"\xd0\x81\xd0\x9b\xd0\x9a\xd0\x90"}));
+	WARP_CHECK(words == sv({"\xd1\x91\xd0\xbb\xd0\xba\xd0\xb0"}));
+
+	warp::tokenizer fold("", warp::normalizer::fold_yo);
+	WARP_CHECK(!tokenize(fold, "\xd0\x81\xd0\x9b\xd0\x9a\xd0\x90", &spans, &words));
+	WARP_CHECK(words == sv({"\xd0\xb5\xd0\xbb\xd0\xba\xd0\xb0"}));
+	return 0;
+}
+
+// tokenizer splits exactly where normalizer puts spaces
+static int test_same_as_normalizer() {
+	const char *pieces[] = {
+		"a", "Bc", "XYZXYZXYZXYZXYZXYZ", " ", "  ", ",", "\t", "\xd0\x81", "\xd0\xb4", "\xc2\xa0", "\xe2\x80\x94",
+		"\xe2\x80\x8d", "\x80", "\xe2\x82", "1", "-",
+	};
+
+	warp::tokenizer tok(",");
+	warp::normalizer norm(",", warp::normalizer::fold_punctuation);
+	std::mt19937 rng(1);
+	sv spans, words;
+	for (int i = 0; i < 20000; ++i) {
+		std::string text;
+		size_t num = rng() % 30;
+		for (size_t j = 0; j < num; ++j)
+			text += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+
+		WARP_CHECK(!tokenize(tok, text, &spans, &words));
+		WARP_CHECK(tok.normalized() == norm.normalize(text));
+	}
+	return 0;
+}
+
+static int test_complete_prefix() {
+	warp::tokenizer tok(",");
+
+	auto prefix = [&] (const std::string &text, size_t max_tail) {
+		return tok.complete_prefix(text.data(), text.size(), max_tail);
+	};
+
+	WARP_CHECK(prefix("", 10) == 0);
+	WARP_CHECK(prefix("word", 10) == 0);
+	WARP_CHECK(prefix("one two", 10) == 4);
+	WARP_CHECK(prefix("one two ", 10) == 8);
+	WARP_CHECK(prefix("one,two", 10) == 4);
+
+	// multibyte separators are not split points, text is cut at the ASCII separator before them
+	WARP_CHECK(prefix("one two\xc2\xa0three", 20) == 4);
+
+	// tail without separator is cut at the sequence boundary once it reaches @max_tail
+	WARP_CHECK(prefix("one abcdefgh", 4) == 12);
+	WARP_CHECK(prefix("one abcdefg\xd0\x96", 4) == 13);
+	WARP_CHECK(prefix("one abcdefg\xd0", 4) == 11);
+	WARP_CHECK(prefix("one abcdef\xe2\x82", 4) == 10);
+
+	// every prefix returned for growing text keeps words whole
+	std::string text = "first second\xd0\x96\xd0\x96 third";
+	for (size_t size = 0; size <= text.size(); ++size) {
+		size_t pos = tok.complete_prefix(text.data(), size, 100);
+		WARP_CHECK(pos <= size);
+		WARP_CHECK(pos == 0 || text[pos - 1] == ' ');
+	}
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"ASCII split points", test_ascii_split},
+		{"long words", test_long_words},
+		{"Unicode split points", test_unicode_split},
+		{"same splits as normalizer", test_same_as_normalizer},
+		{"complete prefix", test_complete_prefix},
+	};
+
+	return warp::test::run(tests);
+}
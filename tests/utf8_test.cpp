@@ -0,0 +1,232 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/utf8.hpp"
+
+#include "test.hpp"
+
+#include <random>
+#include <vector>
+
+using namespace ioremap;
+
+/*
+ * Byte by byte reference decoder: sequence is decoded by its lead byte and rejected
+ * if any continuation byte is missing or the code point is overlong, a surrogate or above U+10FFFF,
+ * rejected sequence is replaced by U+FFFD and consumes only its lead byte.
+ */
+static std::vector<uint32_t> reference_decode(const std::string &text, size_t *errors) {
+	std::vector<uint32_t> ret;
+	*errors = 0;
+
+	size_t pos = 0;
+	while (pos < text.size()) {
+		unsigned char lead = text[pos];
+
+		size_t len;
+		uint32_t code, min;
+		if (lead < 0x80) {
+			ret.push_back(lead);
+			pos++;
+			continue;
+		} else if ((lead & 0xe0) == 0xc0) {
+			len = 2, code = lead & 0x1f, min = 0x80;
+		} else if ((lead & 0xf0) == 0xe0) {
+			len = 3, code = lead & 0x0f, min = 0x800;
+		} else if ((lead & 0xf8) == 0xf0) {
+			len = 4, code = lead & 0x07, min = 0x10000;
+		} else {
+			len = 0, code = 0, min = 0;
+		}
+
+		bool ok = len != 0 && pos + len <= text.size();
+		for (size_t i = 1; ok && i < len; ++i) {
+			unsigned char c = text[pos + i];
+			ok = (c & 0xc0) == 0x80;
+			code = (code << 6) | (c & 0x3f);
+		}
+
+		if (ok && (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)))
+			ok = false;
+
+		if (!ok) {
+			ret.push_back(0xfffd);
+			(*errors)++;
+			pos++;
+			continue;
+		}
+
+		ret.push_back(code);
+		pos += len;
+	}
+
+	return ret;
+}
+
+static std::vector<uint32_t> codes(const ribosome::lstring &ls) {
+	std::vector<uint32_t> ret;
+	for (const auto &l: ls)
+		ret.push_back(l.l);
+	return ret;
+}
+
+// checks decoder, validator and encoder on @text against the reference decoder
+static int check(const std::string &text) {
+	size_t ref_errors;
+	std::vector<uint32_t> ref = reference_decode(text, &ref_errors);
+
+	ribosome::lstring ls;
+	size_t errors = warp::utf8::decode(text.data(), text.size(), &ls);
+	WARP_CHECK(codes(ls) == ref);
+
+	// U+FFFD which is present in the text is not an error
+	WARP_CHECK(errors >= ref_errors);
+
+	size_t offset = ~0UL;
+	bool valid = warp::utf8::valid(text.data(), text.size(), &offset);
+	WARP_CHECK(valid == (ref_errors == 0));
+	if (!valid) {
+		WARP_CHECK(offset < text.size());
+		size_t prefix_errors;
+		reference_decode(text.substr(0, offset), &prefix_errors);
+		WARP_CHECK(prefix_errors == 0);
+	}
+
+	// valid text is encoded back byte to byte
+	std::string encoded = warp::utf8::to_string(ls);
+	if (valid) {
+		WARP_CHECK(encoded == text);
+	}
+	WARP_CHECK(warp::utf8::valid(encoded.data(), encoded.size()));
+	WARP_CHECK(codes(warp::utf8::to_lstring(encoded)) == ref);
+
+	return 0;
+}
+
+static const char *sequences[] = {
+	"\xd0\xbf",			// U+043F
+	"\xe2\x82\xac",			// U+20AC
+	"\xf0\x9f\x98\x80",		// U+1F600
+	"\xef\xbf\xbd",			// U+FFFD itself
+	"\xf4\x8f\xbf\xbf",		// U+10FFFF
+	"\xc0\x80",			// overlong NUL
+	"\xc1\xbf",			// overlong 2-byte
+	"\xe0\x80\x80",			// overlong 3-byte
+	"\xe0\x9f\xbf",
+	"\xf0\x80\x80\x80",		// overlong 4-byte
+	"\xf0\x8f\xbf\xbf",
+	"\xed\xa0\x80",			// surrogates
+	"\xed\xbf\xbf",
+	"\xf4\x90\x80\x80",		// above U+10FFFF
+	"\xf5\x80\x80\x80",
+	"\xf8\x88\x80\x80\x80",
+	"\xfe",
+	"\xff",
+	"\x80",				// stray continuation bytes
+	"\xbf\x80",
+	"\xe2\x82",			// truncated sequences
+	"\xf0\x9f\x98",
+	"\xd0",
+	"\xe2\x28\xa1",			// bad continuation
+	"\xd0\xbf\xe2\x82\xac\xf0\x9f\x98\x80",
+};
+
+// every sequence is placed at each offset around 16 and 32 byte boundaries of ASCII runs
+static int test_simd_boundaries() {
+	for (const char *seq: sequences) {
+		for (size_t head = 0; head <= 70; ++head) {
+			for (size_t tail: {0, 1, 15, 16, 17, 31, 32, 33}) {
+				std::string text = std::string(head, 'a') + seq + std::string(tail, 'b');
+				if (check(text)) {
+					std::cerr << "head: " << head << ", tail: " << tail << std::endl;
+					return -1;
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int test_random() {
+	std::mt19937 rng(1);
+	for (int i = 0; i < 20000; ++i) {
+		std::string text;
+		size_t size = rng() % 100;
+		for (size_t j = 0; j < size; ++j) {
+			// mostly ASCII runs with random bytes and valid sequences in between
+			uint32_t r = rng() % 16;
+			if (r < 10) {
+				text.push_back('a' + rng() % 26);
+			} else if (r < 14) {
+				text.push_back(rng() % 256);
+			} else {
+				text += sequences[rng() % 5];
+			}
+		}
+
+		WARP_CHECK(!check(text));
+	}
+
+	return 0;
+}
+
+static int test_encode() {
+	const uint32_t values[] = { 0, 0x7f, 0x80, 0x7ff, 0x800, 0xd7ff, 0xfffd, 0xffff, 0x10000, 0x10ffff };
+	for (uint32_t v: values) {
+		for (size_t head = 0; head <= 40; ++head) {
+			ribosome::lstring ls;
+			for (size_t i = 0; i < head; ++i)
+				ls.push_back(ribosome::letter('x'));
+			ls.push_back(ribosome::letter(v));
+			ls.push_back(ribosome::letter('y'));
+
+			std::string text = warp::utf8::to_string(ls);
+			WARP_CHECK(codes(warp::utf8::to_lstring(text)) == codes(ls));
+		}
+	}
+
+	// letters which can not be encoded become U+FFFD
+	const uint32_t bad[] = { 0xd800, 0xdfff, 0x110000, 0xffffffff };
+	for (uint32_t v: bad) {
+		ribosome::lstring ls;
+		ls.push_back(ribosome::letter(v));
+		WARP_CHECK(warp::utf8::to_string(ls) == "\xef\xbf\xbd");
+	}
+
+	return 0;
+}
+
+static int test_boundary() {
+	const std::string text = "ab\xd0\xbf\xe2\x82\xac\xf0\x9f\x98\x80";
+	const size_t expected[] = { 0, 1, 2, 2, 4, 4, 4, 7, 7, 7, 7, 11 };
+	for (size_t size = 0; size <= text.size(); ++size) {
+		WARP_CHECK(warp::utf8::boundary(text.data(), size) == expected[size]);
+	}
+
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"invalid sequences at SIMD boundaries", test_simd_boundaries},
+		{"random input", test_random},
+		{"encode", test_encode},
+		{"sequence boundary", test_boundary},
+	};
+
+	return warp::test::run(tests);
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright 2014+ Evgeniy Polyakov <zbr@ioremap.net>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "warp/xor_filter.hpp"
+
+#include "test.hpp"
+
+#include <map>
+#include <random>
+
+using namespace ioremap;
+
+typedef std::vector<std::pair<uint64_t, uint8_t>> keys_t;
+
+static keys_t random_keys(size_t num, uint64_t seed) {
+	std::mt19937_64 rng(seed);
+
+	keys_t keys;
+	for (size_t i = 0; i < num; ++i) {
+		keys.emplace_back(rng(), 1 << (rng() % 8));
+	}
+
+	return keys;
+}
+
+// every added word is found with its exact value after peeling, whatever the number of words is
+static int test_no_false_negatives() {
+	const size_t sizes[] = { 1, 2, 3, 10, 100, 1000, 200000 };
+	for (size_t num: sizes) {
+		keys_t keys = random_keys(num, num);
+		const keys_t orig = keys;
+
+		warp::word_filter filter;
+		auto err = filter.build(keys);
+		WARP_CHECK(!err);
+		WARP_CHECK(!filter.empty());
+		WARP_CHECK(filter.size() == num);
+
+		for (const auto &k: orig) {
+			WARP_CHECK(filter.find(k.first) == k.second);
+		}
+	}
+	return 0;
+}
+
+// values of the same word coming from several dictionaries are or'ed
+static int test_merged_values() {
+	keys_t keys;
+	std::map<std::string, uint8_t> expected;
+	const char *words[] = { "hello", "привет", "hallo", "ciao", "hola" };
+	for (int lang = 0; lang < 8; ++lang) {
+		for (int i = 0; i < 5; ++i) {
+			if ((i + lang) % 3 == 0)
+				continue;
+
+			keys.emplace_back(warp::word_filter::hash(words[i]), 1 << lang);
+			expected[words[i]] |= 1 << lang;
+		}
+	}
+
+	warp::word_filter filter;
+	WARP_CHECK(!filter.build(keys));
+	WARP_CHECK(filter.size() == expected.size());
+	for (const auto &e: expected) {
+		WARP_CHECK(filter.find(e.first) == e.second);
+	}
+
+	WARP_CHECK(filter.find("unknown") == 0);
+	WARP_CHECK(filter.find("") == 0);
+	return 0;
+}
+
+// fingerprint is 24 bits, so there must be about one false positive out of 2^24 unknown words
+static int test_false_positives() {
+	keys_t keys = random_keys(100000, 1);
+	warp::word_filter filter;
+	WARP_CHECK(!filter.build(keys));
+
+	std::mt19937_64 rng(2);
+	size_t positives = 0;
+	for (size_t i = 0; i < 1000000; ++i) {
+		if (filter.find(rng()))
+			positives++;
+	}
+
+	WARP_CHECK(positives < 10);
+	return 0;
+}
+
+// filter which could not be built is empty and does not find anything, including words of the previous build
+static int test_build_failure() {
+	keys_t keys = random_keys(1000, 3);
+	const keys_t orig = keys;
+
+	warp::word_filter filter;
+	WARP_CHECK(!filter.build(keys));
+	WARP_CHECK(filter.find(orig[0].first) == orig[0].second);
+
+	auto err = filter.build(keys, 0);
+	WARP_CHECK(err);
+	WARP_CHECK(err.code() == -EINVAL);
+	WARP_CHECK(filter.empty());
+	WARP_CHECK(filter.size() == 0);
+	for (const auto &k: orig) {
+		WARP_CHECK(filter.find(k.first) == 0);
+	}
+
+	keys_t empty;
+	WARP_CHECK(!filter.build(empty));
+	WARP_CHECK(filter.empty());
+	WARP_CHECK(filter.find("word") == 0);
+	return 0;
+}
+
+int main() {
+	const warp::test::test_case tests[] = {
+		{"no false negatives", test_no_false_negatives},
+		{"merged values", test_merged_values},
+		{"false positives", test_false_positives},
+		{"build failure", test_build_failure},
+	};
+
+	return warp::test::run(tests);
+}